@@ -1,5 +1,6 @@
 CYCLONE_ENABLED := 0
 HAVE_GRIFFIN    := 0
+HAVE_7Z         := 1
 
 LOCAL_PATH := $(call my-dir)
 
@@ -35,8 +36,7 @@ ifeq ($(TARGET_ARCH),mips)
 LOCAL_CXXFLAGS += -DANDROID_MIPS -D__mips__ -D__MIPSEL__
 endif
 
-BURN_BLACKLIST := $(FBA_BURNER_DIR)/un7z.cpp \
-	$(FBA_CPU_DIR)/arm7/arm7exec.c \
+BURN_BLACKLIST := $(FBA_CPU_DIR)/arm7/arm7exec.c \
 	$(FBA_CPU_DIR)/arm7/arm7core.c \
 	$(FBA_CPU_DIR)/hd6309/6309tbl.c \
 	$(FBA_CPU_DIR)/hd6309/6309ops.c \
@@ -107,12 +107,19 @@ FBA_CPU_DIRS := $(FBA_CPU_DIR) \
 
 FBA_SRC_DIRS := $(FBA_BURNER_DIR) $(FBA_BURN_DIRS) $(FBA_CPU_DIRS) $(FBA_BURNER_DIRS)
 
-LOCAL_MODULE    := libretro
+ifeq ($(HAVE_7Z), 1)
+LIB7Z_DIR := $(FBA_LIB_DIR)/lib7z
+LIB7Z_SRCS := $(addprefix $(LIB7Z_DIR)/, 7zAlloc.c 7zBuf.c 7zCrc.c 7zCrcOpt.c 7zDec.c 7zFile.c 7zIn.c 7zStream.c \
+	Bcj2.c Bra.c Bra86.c CpuArch.c Lzma2Dec.c LzmaDec.c)
+GLOBAL_DEFINES += -DINCLUDE_7Z_SUPPORT
+else
+BURN_BLACKLIST += $(FBA_BURNER_DIR)/un7z.cpp
+endif
 
+LOCAL_MODULE    := libretro
 
-LOCAL_SRC_FILES := $(GRIFFIN_CXX_SRC_FILES) $(CYCLONE_SRC)  $(filter-out $(BURN_BLACKLIST),$(foreach dir,$(FBA_SRC_DIRS),$(wildcard $(dir)/*.cpp))) $(filter-out $(BURN_BLACKLIST),$(foreach dir,$(FBA_SRC_DIRS),$(wildcard $(dir)/*.c))) $(LIBRETRO_DIR)/libretro.cpp
 
-GLOBAL_DEFINES :=
+LOCAL_SRC_FILES := $(GRIFFIN_CXX_SRC_FILES) $(CYCLONE_SRC)  $(filter-out $(BURN_BLACKLIST),$(foreach dir,$(FBA_SRC_DIRS),$(wildcard $(dir)/*.cpp))) $(filter-out $(BURN_BLACKLIST),$(foreach dir,$(FBA_SRC_DIRS),$(wildcard $(dir)/*.c))) $(LIBRETRO_DIR)/libretro.cpp $(LIB7Z_SRCS)
 
 LOCAL_CXXFLAGS += -O2 -fno-stack-protector -DUSE_SPEEDHACKS -DINLINE="static inline" -DSH2_INLINE="static inline" -D__LIBRETRO_OPTIMIZATIONS__ -D__LIBRETRO__ -Wno-write-strings -DUSE_FILE32API -DANDROID -DFRONTEND_SUPPORTS_RGB565 $(CYCLONE_DEFINES) $(GLOBAL_DEFINES)
 LOCAL_CFLAGS = -O2 -fno-stack-protector -DUSE_SPEEDHACKS -DINLINE="static inline" -DSH2_INLINE="static inline" -D__LIBRETRO_OPTIMIZATIONS__ -D__LIBRETRO__ -Wno-write-strings -DUSE_FILE32API -DANDROID -DFRONTEND_SUPPORTS_RGB565 $(CYCLONE_DEFINES) $(GLOBAL_DEFINES)
@@ -133,7 +140,8 @@ LOCAL_C_INCLUDES = $(FBA_BURNER_DIR)/win32 \
 	$(FBA_LIB_DIR)/zlib \
 	$(FBA_BURN_DIR)/drv/capcom \
 	$(FBA_GENERATED_DIR) \
-	$(FBA_LIB_DIR)
+	$(FBA_LIB_DIR) \
+	$(LIB7Z_DIR)
 
 LOCAL_LDLIBS += -lz
 
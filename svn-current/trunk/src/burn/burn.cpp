@@ -4,6 +4,15 @@
 #include "burnint.h"
 #include "burn_sound.h"
 #include "driverlist.h"
+#include "burn_thread.h"
+
+#if defined (_WIN32)
+ #define WIN32_LEAN_AND_MEAN
+ #include <windows.h>
+#else
+ #include <sys/time.h>
+ #include <time.h>
+#endif
 
 // filler function, used if the application is not printing debug messages
 static INT32 __cdecl BurnbprintfFiller(INT32, TCHAR* , ...) { return 0; }
@@ -41,6 +50,13 @@ INT32 nBurnCPUSpeedAdjust = 0x0100;	// CPU speed adjustment (clock * nBurnCPUSpe
 UINT8* pBurnDraw = NULL;	// Pointer to correctly sized bitmap
 INT32 nBurnPitch = 0;					// Pitch between each line
 INT32 nBurnBpp;						// Bytes per pixel (2, 3, or 4)
+bool bBurnFrameUnchanged = false;	// Set by drivers when pBurnDraw was left as is because the frame didn't change
+
+UINT32 nBurnFrameTimeCpu = 0;		// Time the driver spent on the last frame, in microseconds
+UINT32 nBurnFrameTimeDraw = 0;		// (only filled in by drivers which measure it)
+UINT32 nBurnFrameTimeSound = 0;
+
+static BurnLock* pBurnPhaseLock = NULL;	// made by BurnPhaseReset()
 
 INT32 nBurnSoundRate = 0;				// sample rate of sound or zero for no sound
 INT32 nBurnSoundLen = 0;				// length in samples per frame
@@ -86,6 +102,11 @@ extern "C" INT32 BurnLibExit()
 {
 	nBurnDrvCount = 0;
 
+	if (pBurnPhaseLock) {
+		BurnLockDestroy(pBurnPhaseLock);
+		pBurnPhaseLock = NULL;
+	}
+
 	return 0;
 }
 
@@ -707,9 +728,147 @@ extern "C" INT32 BurnDrvFrame()
 {
 	CheatApply();									// Apply cheats (if any)
 	HiscoreApply();
+	bBurnFrameUnchanged = false;
+	nBurnFrameTimeCpu = nBurnFrameTimeDraw = nBurnFrameTimeSound = 0;
 	return pDriver[nBurnDrvActive]->Frame();		// Forward to drivers function
 }
 
+// Monotonic time in microseconds, for measuring how long things take
+extern "C" UINT64 BurnGetTime()
+{
+#if defined (_WIN32)
+	LARGE_INTEGER nCount, nFreq;
+	QueryPerformanceCounter(&nCount);
+	QueryPerformanceFrequency(&nFreq);
+	return (UINT64)(nCount.QuadPart / nFreq.QuadPart) * 1000000 + (UINT64)(nCount.QuadPart % nFreq.QuadPart) * 1000000 / nFreq.QuadPart;
+#elif defined (CLOCK_MONOTONIC)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (UINT64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (UINT64)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Phase timing
+
+#define BURN_PHASE_MAX		64
+#define BURN_PHASE_DEPTH	16
+
+static BurnPhase BurnPhaseList[BURN_PHASE_MAX];
+static INT32 nBurnPhaseCount = 0;
+static INT32 nBurnPhaseOpen[BURN_PHASE_DEPTH];		// open spans, -1 if there was no room for one
+static INT32 nBurnPhaseDepth = 0;
+static UINT64 nBurnPhaseStart = 0;
+
+extern "C" INT32 BurnPhaseReset()
+{
+	if (pBurnPhaseLock == NULL) {
+		pBurnPhaseLock = BurnLockCreate();
+	}
+
+	nBurnPhaseCount = 0;
+	nBurnPhaseDepth = 0;
+	nBurnPhaseStart = BurnGetTime();
+
+	return 0;
+}
+
+extern "C" INT32 BurnPhaseBegin(const char* szName)
+{
+	if (nBurnPhaseDepth >= BURN_PHASE_DEPTH) {
+		nBurnPhaseDepth++;
+		return 1;
+	}
+
+	INT32 n = -1;
+
+	if (pBurnPhaseLock) {
+		BurnLockEnter(pBurnPhaseLock);
+		if (nBurnPhaseCount < BURN_PHASE_MAX) {
+			n = nBurnPhaseCount++;
+			BurnPhaseList[n].szName = szName;
+			BurnPhaseList[n].nDepth = nBurnPhaseDepth;
+			BurnPhaseList[n].bOpen = 1;
+			BurnPhaseList[n].nStart = BurnGetTime() - nBurnPhaseStart;
+			BurnPhaseList[n].nTime = 0;
+		}
+		BurnLockLeave(pBurnPhaseLock);
+	}
+
+	nBurnPhaseOpen[nBurnPhaseDepth++] = n;
+
+	return (n < 0) ? 1 : 0;
+}
+
+extern "C" INT32 BurnPhaseEnd()
+{
+	if (nBurnPhaseDepth <= 0) {
+		return 1;
+	}
+
+	nBurnPhaseDepth--;
+	if (nBurnPhaseDepth >= BURN_PHASE_DEPTH || nBurnPhaseOpen[nBurnPhaseDepth] < 0) {
+		return 1;
+	}
+
+	BurnPhase* pPhase = &BurnPhaseList[nBurnPhaseOpen[nBurnPhaseDepth]];
+	pPhase->nTime = BurnGetTime() - nBurnPhaseStart - pPhase->nStart;
+	pPhase->bOpen = 0;
+
+	return 0;
+}
+
+extern "C" INT32 BurnPhaseAdd(const char* szName, UINT64 nTime)
+{
+	if (pBurnPhaseLock == NULL) {
+		return 1;
+	}
+
+	INT32 nRet = 1;
+
+	BurnLockEnter(pBurnPhaseLock);
+
+	for (INT32 i = 0; i < nBurnPhaseCount; i++) {
+		if (BurnPhaseList[i].nDepth < 0 && strcmp(BurnPhaseList[i].szName, szName) == 0) {
+			BurnPhaseList[i].nTime += nTime;
+			nRet = 0;
+			break;
+		}
+	}
+
+	if (nRet && nBurnPhaseCount < BURN_PHASE_MAX) {
+		BurnPhase* pPhase = &BurnPhaseList[nBurnPhaseCount++];
+		pPhase->szName = szName;
+		pPhase->nDepth = -1;
+		pPhase->bOpen = 0;
+		pPhase->nStart = 0;
+		pPhase->nTime = nTime;
+		nRet = 0;
+	}
+
+	BurnLockLeave(pBurnPhaseLock);
+
+	return nRet;
+}
+
+extern "C" INT32 BurnPhaseGet(INT32 n, struct BurnPhase* pPhase)
+{
+	if (n < 0 || n >= nBurnPhaseCount || pPhase == NULL) {
+		return 1;
+	}
+
+	*pPhase = BurnPhaseList[n];
+	if (pPhase->bOpen) {
+		pPhase->nTime = BurnGetTime() - nBurnPhaseStart - pPhase->nStart;
+	}
+
+	return 0;
+}
+
 // Force redraw of the screen
 extern "C" INT32 BurnDrvRedraw()
 {
@@ -814,6 +973,10 @@ INT32 BurnByteswap(UINT8* pMem, INT32 nLen)
 
 // Application-defined rom loading function:
 INT32 (__cdecl *BurnExtLoadRom)(UINT8 *Dest, INT32 *pnWrote, INT32 i) = NULL;
+bool bBurnExtLoadRomThreadSafe = false;
+
+// Application-defined rom file stamp
+UINT32 (__cdecl *BurnExtRomStamp)(INT32 i) = NULL;
 
 // Application-defined colour conversion function
 static UINT32 __cdecl BurnHighColFiller(INT32, INT32, INT32, INT32) { return (UINT32)(~0); }
@@ -89,6 +89,11 @@ enum BurnCartrigeCommand { CART_INIT_START, CART_INIT_END, CART_EXIT };
 
 // Application-defined rom loading function
 extern INT32 (__cdecl *BurnExtLoadRom)(UINT8* Dest, INT32* pnWrote, INT32 i);
+extern bool bBurnExtLoadRomThreadSafe;		// BurnExtLoadRom can be called from several threads at once
+
+// Application-defined function returning a value which changes when the file rom i is loaded from does (size, date),
+// for drivers which keep prepared roms on disk. NULL or 0 if unknown.
+extern UINT32 (__cdecl *BurnExtRomStamp)(INT32 i);
 
 // Application-defined progress indicator functions
 extern INT32 (__cdecl *BurnExtProgressRangeCallback)(double dProgressRange);
@@ -194,6 +199,11 @@ extern INT32 nMaxPlayers;
 extern UINT8 *pBurnDraw;			// Pointer to correctly sized bitmap
 extern INT32 nBurnPitch;						// Pitch between each line
 extern INT32 nBurnBpp;						// Bytes per pixel (2, 3, or 4)
+extern bool bBurnFrameUnchanged;		// Set by drivers when pBurnDraw was left as is because the frame didn't change
+
+extern UINT32 nBurnFrameTimeCpu;		// Time the driver spent on the last frame, in microseconds
+extern UINT32 nBurnFrameTimeDraw;		// (only filled in by drivers which measure it)
+extern UINT32 nBurnFrameTimeSound;
 
 extern UINT8 nBurnLayer;			// Can be used externally to select which layers to show
 extern UINT8 nSpriteEnable;			// Can be used externally to select which Sprites to show
@@ -225,6 +235,24 @@ INT32 BurnDrvExit();
 INT32 BurnDrvCartridgeSetup(BurnCartrigeCommand nCommand);
 
 INT32 BurnDrvFrame();
+UINT64 BurnGetTime();
+
+// Startup phase timing. Spans are opened and closed on the main thread and may
+// nest; totals can be added to from any thread, e.g. time spent per rom on
+// whichever thread loaded it. Names are kept by pointer, so use literals.
+struct BurnPhase {
+	const char* szName;
+	INT32 nDepth;			// nesting level, -1 for a total
+	INT32 bOpen;			// span not ended yet
+	UINT64 nStart;			// microseconds after BurnPhaseReset()
+	UINT64 nTime;			// microseconds
+};
+
+INT32 BurnPhaseReset();								// forget everything and start the clock
+INT32 BurnPhaseBegin(const char* szName);
+INT32 BurnPhaseEnd();									// ends the innermost open span
+INT32 BurnPhaseAdd(const char* szName, UINT64 nTime);	// ignored before BurnPhaseReset()
+INT32 BurnPhaseGet(INT32 n, struct BurnPhase* pPhase);	// 1 past the last one
 INT32 BurnDrvRedraw();
 INT32 BurnRecalcPal();
 INT32 BurnDrvGetPaletteEntries();
@@ -0,0 +1,358 @@
+#include "burnint.h"
+#include "burn_thread.h"
+
+#if defined (BURN_THREAD_WIN32)
+ #define WIN32_LEAN_AND_MEAN
+ #include <windows.h>
+#elif defined (BURN_THREAD_PTHREAD)
+ #include <pthread.h>
+ #include <unistd.h>
+#endif
+
+struct BurnWorker {
+	pBurnWorkerJob pJob;
+	void *pParam;
+	bool bBusy;
+	bool bQuit;
+#if defined (BURN_THREAD_WIN32)
+	HANDLE hThread;
+	HANDLE hStart;			// auto-reset, signalled when a job (or quit) is posted
+	HANDLE hIdle;			// manual-reset, signalled while no job is running
+#elif defined (BURN_THREAD_PTHREAD)
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#endif
+};
+
+#if defined (BURN_THREAD_WIN32)
+
+static DWORD WINAPI BurnWorkerMain(LPVOID pArg)
+{
+	BurnWorker *pWorker = (BurnWorker *)pArg;
+
+	while (1) {
+		WaitForSingleObject(pWorker->hStart, INFINITE);
+		if (pWorker->bBusy) {
+			pWorker->pJob(pWorker->pParam);
+			pWorker->bBusy = false;
+			SetEvent(pWorker->hIdle);
+		}
+		if (pWorker->bQuit) break;
+	}
+
+	return 0;
+}
+
+BurnWorker *BurnWorkerCreate()
+{
+	BurnWorker *pWorker = (BurnWorker *)calloc(1, sizeof(BurnWorker));
+	if (pWorker == NULL) return NULL;
+
+	pWorker->hStart = CreateEvent(NULL, FALSE, FALSE, NULL);
+	pWorker->hIdle = CreateEvent(NULL, TRUE, TRUE, NULL);
+	if (pWorker->hStart && pWorker->hIdle) {
+		pWorker->hThread = CreateThread(NULL, 0, BurnWorkerMain, pWorker, 0, NULL);
+	}
+
+	if (pWorker->hThread == NULL) {
+		if (pWorker->hStart) CloseHandle(pWorker->hStart);
+		if (pWorker->hIdle) CloseHandle(pWorker->hIdle);
+		free(pWorker);
+		return NULL;
+	}
+
+	return pWorker;
+}
+
+void BurnWorkerWait(BurnWorker *pWorker)
+{
+	WaitForSingleObject(pWorker->hIdle, INFINITE);
+}
+
+void BurnWorkerSubmit(BurnWorker *pWorker, pBurnWorkerJob pJob, void *pParam)
+{
+	BurnWorkerWait(pWorker);
+
+	ResetEvent(pWorker->hIdle);
+	pWorker->pJob = pJob;
+	pWorker->pParam = pParam;
+	pWorker->bBusy = true;
+	SetEvent(pWorker->hStart);
+}
+
+void BurnWorkerDestroy(BurnWorker *pWorker)
+{
+	if (pWorker == NULL) return;
+
+	BurnWorkerWait(pWorker);
+	pWorker->bQuit = true;
+	SetEvent(pWorker->hStart);
+	WaitForSingleObject(pWorker->hThread, INFINITE);
+
+	CloseHandle(pWorker->hThread);
+	CloseHandle(pWorker->hStart);
+	CloseHandle(pWorker->hIdle);
+	free(pWorker);
+}
+
+struct BurnLock {
+	CRITICAL_SECTION cs;
+};
+
+BurnLock *BurnLockCreate()
+{
+	BurnLock *pLock = (BurnLock *)calloc(1, sizeof(BurnLock));
+	if (pLock) InitializeCriticalSection(&pLock->cs);
+
+	return pLock;
+}
+
+void BurnLockDestroy(BurnLock *pLock)
+{
+	if (pLock == NULL) return;
+
+	DeleteCriticalSection(&pLock->cs);
+	free(pLock);
+}
+
+void BurnLockEnter(BurnLock *pLock)
+{
+	EnterCriticalSection(&pLock->cs);
+}
+
+void BurnLockLeave(BurnLock *pLock)
+{
+	LeaveCriticalSection(&pLock->cs);
+}
+
+INT32 BurnThreadCount()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+
+	return (info.dwNumberOfProcessors > 0) ? info.dwNumberOfProcessors : 1;
+}
+
+#elif defined (BURN_THREAD_PTHREAD)
+
+static void *BurnWorkerMain(void *pArg)
+{
+	BurnWorker *pWorker = (BurnWorker *)pArg;
+
+	pthread_mutex_lock(&pWorker->lock);
+	while (1) {
+		while (!pWorker->bBusy && !pWorker->bQuit) {
+			pthread_cond_wait(&pWorker->cond, &pWorker->lock);
+		}
+		if (!pWorker->bBusy) break;
+
+		pthread_mutex_unlock(&pWorker->lock);
+		pWorker->pJob(pWorker->pParam);
+		pthread_mutex_lock(&pWorker->lock);
+
+		pWorker->bBusy = false;
+		pthread_cond_broadcast(&pWorker->cond);
+	}
+	pthread_mutex_unlock(&pWorker->lock);
+
+	return NULL;
+}
+
+BurnWorker *BurnWorkerCreate()
+{
+	BurnWorker *pWorker = (BurnWorker *)calloc(1, sizeof(BurnWorker));
+	if (pWorker == NULL) return NULL;
+
+	pthread_mutex_init(&pWorker->lock, NULL);
+	pthread_cond_init(&pWorker->cond, NULL);
+
+	if (pthread_create(&pWorker->thread, NULL, BurnWorkerMain, pWorker)) {
+		pthread_cond_destroy(&pWorker->cond);
+		pthread_mutex_destroy(&pWorker->lock);
+		free(pWorker);
+		return NULL;
+	}
+
+	return pWorker;
+}
+
+void BurnWorkerWait(BurnWorker *pWorker)
+{
+	pthread_mutex_lock(&pWorker->lock);
+	while (pWorker->bBusy) {
+		pthread_cond_wait(&pWorker->cond, &pWorker->lock);
+	}
+	pthread_mutex_unlock(&pWorker->lock);
+}
+
+void BurnWorkerSubmit(BurnWorker *pWorker, pBurnWorkerJob pJob, void *pParam)
+{
+	pthread_mutex_lock(&pWorker->lock);
+	while (pWorker->bBusy) {
+		pthread_cond_wait(&pWorker->cond, &pWorker->lock);
+	}
+	pWorker->pJob = pJob;
+	pWorker->pParam = pParam;
+	pWorker->bBusy = true;
+	pthread_cond_broadcast(&pWorker->cond);
+	pthread_mutex_unlock(&pWorker->lock);
+}
+
+void BurnWorkerDestroy(BurnWorker *pWorker)
+{
+	if (pWorker == NULL) return;
+
+	pthread_mutex_lock(&pWorker->lock);
+	pWorker->bQuit = true;
+	pthread_cond_broadcast(&pWorker->cond);
+	pthread_mutex_unlock(&pWorker->lock);
+
+	pthread_join(pWorker->thread, NULL);
+
+	pthread_cond_destroy(&pWorker->cond);
+	pthread_mutex_destroy(&pWorker->lock);
+	free(pWorker);
+}
+
+struct BurnLock {
+	pthread_mutex_t mutex;
+};
+
+BurnLock *BurnLockCreate()
+{
+	BurnLock *pLock = (BurnLock *)calloc(1, sizeof(BurnLock));
+	if (pLock) pthread_mutex_init(&pLock->mutex, NULL);
+
+	return pLock;
+}
+
+void BurnLockDestroy(BurnLock *pLock)
+{
+	if (pLock == NULL) return;
+
+	pthread_mutex_destroy(&pLock->mutex);
+	free(pLock);
+}
+
+void BurnLockEnter(BurnLock *pLock)
+{
+	pthread_mutex_lock(&pLock->mutex);
+}
+
+void BurnLockLeave(BurnLock *pLock)
+{
+	pthread_mutex_unlock(&pLock->mutex);
+}
+
+INT32 BurnThreadCount()
+{
+	long nCount = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (nCount > 0) ? (INT32)nCount : 1;
+}
+
+#else
+
+// no threads, jobs run as soon as they are submitted
+
+BurnWorker *BurnWorkerCreate()
+{
+	return (BurnWorker *)calloc(1, sizeof(BurnWorker));
+}
+
+void BurnWorkerWait(BurnWorker *)
+{
+}
+
+void BurnWorkerSubmit(BurnWorker *, pBurnWorkerJob pJob, void *pParam)
+{
+	pJob(pParam);
+}
+
+void BurnWorkerDestroy(BurnWorker *pWorker)
+{
+	free(pWorker);
+}
+
+struct BurnLock {
+	INT32 nDummy;
+};
+
+BurnLock *BurnLockCreate()
+{
+	return (BurnLock *)calloc(1, sizeof(BurnLock));
+}
+
+void BurnLockDestroy(BurnLock *pLock)
+{
+	free(pLock);
+}
+
+void BurnLockEnter(BurnLock *)
+{
+}
+
+void BurnLockLeave(BurnLock *)
+{
+}
+
+INT32 BurnThreadCount()
+{
+	return 1;
+}
+
+#endif
+
+// ------------------------------------------------------------------------
+
+#define MAX_PARALLEL	16
+
+struct BurnParallelRange {
+	pBurnParallelJob pJob;
+	void *pParam;
+	INT32 nStart;
+	INT32 nEnd;
+};
+
+static void BurnParallelRun(void *pArg)
+{
+	BurnParallelRange *pRange = (BurnParallelRange *)pArg;
+
+	pRange->pJob(pRange->nStart, pRange->nEnd, pRange->pParam);
+}
+
+void BurnParallelFor(INT32 nCount, pBurnParallelJob pJob, void *pParam)
+{
+	INT32 nThreads = BurnThreadCount();
+	if (nThreads > MAX_PARALLEL) nThreads = MAX_PARALLEL;
+	if (nThreads > nCount) nThreads = nCount;
+
+	BurnParallelRange Range[MAX_PARALLEL];
+	BurnWorker *pWorker[MAX_PARALLEL];
+	INT32 nWorkers = 0;
+
+	// the last range is done on this thread
+	for (INT32 i = 0; i < nThreads - 1; i++) {
+		pWorker[nWorkers] = BurnWorkerCreate();
+		if (pWorker[nWorkers] == NULL) break;
+		nWorkers++;
+	}
+
+	for (INT32 i = 0; i <= nWorkers; i++) {
+		Range[i].pJob = pJob;
+		Range[i].pParam = pParam;
+		Range[i].nStart = (INT32)((INT64)nCount * i / (nWorkers + 1));
+		Range[i].nEnd = (INT32)((INT64)nCount * (i + 1) / (nWorkers + 1));
+	}
+
+	for (INT32 i = 0; i < nWorkers; i++) {
+		BurnWorkerSubmit(pWorker[i], BurnParallelRun, &Range[i]);
+	}
+
+	BurnParallelRun(&Range[nWorkers]);
+
+	for (INT32 i = 0; i < nWorkers; i++) {
+		BurnWorkerDestroy(pWorker[i]);
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef _BURN_THREAD_H
+#define _BURN_THREAD_H
+
+// Background worker threads
+//
+// A worker runs one job at a time on its own thread. BurnWorkerSubmit() waits
+// for the previous job before handing over the next one, and BurnWorkerWait()
+// returns once the current job is finished. On targets without threads the
+// job is simply run inside BurnWorkerSubmit().
+
+#if defined (_WIN32) && !defined (_XBOX)
+ #define BURN_THREAD_WIN32
+#elif (defined (__unix__) || defined (__APPLE__) || defined (__ANDROID__)) && !defined (GEKKO) && !defined (_3DS) && !defined (VITA) && !defined (__PSL1GHT__) && !defined (__CELLOS_LV2__) && !defined (__EMSCRIPTEN__)
+ #define BURN_THREAD_PTHREAD
+#endif
+
+typedef void (*pBurnWorkerJob)(void *pParam);
+
+struct BurnWorker;
+
+BurnWorker *BurnWorkerCreate();					// NULL if no thread could be started
+void BurnWorkerDestroy(BurnWorker *pWorker);		// finishes the current job first
+void BurnWorkerSubmit(BurnWorker *pWorker, pBurnWorkerJob pJob, void *pParam);
+void BurnWorkerWait(BurnWorker *pWorker);
+
+INT32 BurnThreadCount();							// hardware threads, 1 without thread support
+
+// A lock for data shared between threads. Does nothing without thread support.
+struct BurnLock;
+
+BurnLock *BurnLockCreate();						// NULL if it couldn't be made
+void BurnLockDestroy(BurnLock *pLock);
+void BurnLockEnter(BurnLock *pLock);
+void BurnLockLeave(BurnLock *pLock);
+
+// Splits 0 - nCount into one range per hardware thread and runs pJob on each,
+// returning once they are all done.
+typedef void (*pBurnParallelJob)(INT32 nStart, INT32 nEnd, void *pParam);
+
+void BurnParallelFor(INT32 nCount, pBurnParallelJob pJob, void *pParam);
+
+#endif
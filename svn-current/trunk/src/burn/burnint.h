@@ -111,6 +111,20 @@ INT32 BurnClearScreen();
 // load.cpp
 INT32 BurnLoadRom(UINT8* Dest, INT32 i, INT32 nGap);
 INT32 BurnXorRom(UINT8* Dest, INT32 i, INT32 nGap);
+INT32 BurnByteswap32(UINT8* pMem, INT32 nLen);
+
+// nRoms roms from i on, a byte at a time, like BurnLoadRom(Dest + n, i + n, nRoms)
+INT32 BurnLoadRomGroup(UINT8* Dest, INT32 i, INT32 nRoms);
+
+struct BurnRomGroup {
+	UINT8* Dest;
+	INT32 i;
+	INT32 nRoms;
+	INT32 nRet;
+};
+
+// loads several groups, side by side when the application's loader allows it
+INT32 BurnLoadRomGroups(struct BurnRomGroup* pGroups, INT32 nCount);
 INT32 BurnLoadBitField(UINT8* pDest, UINT8* pSrc, INT32 nField, INT32 nSrcLen);
 
 // ---------------------------------------------------------------------------
@@ -10,6 +10,13 @@
 
 extern UINT8 cps3_reset;
 extern UINT8 cps3_palette_change;
+extern INT32 cps3_preview_shift;		// 1 or 2 draws the screen at 1/2 or 1/4 resolution
+extern INT32 cps3_chardma_disk_cache;	// keep decompressed graphics in <game>.chr between sessions
+extern INT32 cps3_rom_cache;			// keep the prepared roms in <game>.rom
+extern INT32 cps3_rom_share;			// share the prepared roms with other running instances (Linux)
+extern INT32 cps3_user_compress;		// keep the graphics and sound roms compressed in memory
+
+UINT8 *cps3_user_block(UINT32 block);	// 64KB of the user rom, in low memory mode
 
 extern UINT16 *Cps3CurPal;
 
@@ -19,11 +19,32 @@ Port to FBA by OopsWare
 
 #include "cps3.h"
 #include "sh2_intf.h"
+#include "burn_thread.h"
+
+#if defined (__linux__) && !defined (WII_VM)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if !defined (__ANDROID__)
+#include <sys/file.h>
+#include <dirent.h>
+#define CPS3_ROM_SHARE	1
+#endif
+#endif
 
 #define	BE_GFX		1
 //#define	FAST_BOOT	1
 #define SPEED_HACK	1		// Default should be 1, if not FPS would drop.
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define CPS3_SSE2	1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CPS3_NEON	1
+#include <arm_neon.h>
+#endif
+
 #ifdef WII_VM
 #include "libretro.h"
 #include "wii_vm.h"
@@ -36,7 +57,7 @@ static UINT8 *RamStart, *RamEnd;
 
 static UINT8 *RomBios;
 static UINT8 *RomGame;
-static UINT8 *RomGame_D;
+static UINT8 *RomGame_D;	// same memory as RomGame unless cps3_isSpecial
 static UINT8 *RomUser;
 
 static UINT8 *RamMain;
@@ -55,10 +76,30 @@ static UINT8 *RamC000_D;
 static UINT16 *EEPROM;
 
 UINT16 *Cps3CurPal;
+static UINT16 *Cps3PalLut;		// RamPal colour (xBGR 555) to output format
 static UINT32 *RamScreen;
 
+static UINT32 *RamSprLast;		// render inputs of the last frame drawn
+static UINT32 *RamSSLast;
+static UINT32 RamVRegLast[0x40];
+
+typedef struct
+{
+	UINT32 key;			// tile | flip << 9 | pal << 11, ~0 when unused
+	UINT32 ss_gen;
+	UINT32 pal_gen;
+	INT32 solid;			// 0 = fully transparent, 1 = needs blending, 2 = opaque
+	UINT16 pix[64];			// transparent pixels are 0
+	UINT16 mask[64];		// 0xffff where opaque
+} cps3_glyph;
+
+#define CPS3_GLYPH_SLOTS	2048
+
+static cps3_glyph *Cps3Glyphs;		// text layer tiles in output format
+
 UINT8 cps3_reset = 0;
 UINT8 cps3_palette_change = 0;
+INT32 cps3_preview_shift = 0;
 
 UINT32 cps3_key1, cps3_key2, cps3_isSpecial;
 UINT32 cps3_bios_test_hack, cps3_game_test_hack;
@@ -91,6 +132,40 @@ static UINT32 chardma_table_address = 0;
 
 static INT32 cps3_gfx_width, cps3_gfx_height;
 static INT32 cps3_gfx_max_x, cps3_gfx_max_y;
+static INT32 cps3_gfx_read_x, cps3_gfx_read_y;	// last RamScreen pixel the compose pass reads
+
+static UINT32 cps3_pal_gen = 0;		// bumped whenever Cps3CurPal changes
+static UINT32 cps3_cram_gen = 0;	// bumped whenever RamCRam changes
+static INT32 cps3_redraw = 1;		// force a full redraw of the next frame
+
+static UINT8 cps3_line_sampled[512];	// RamScreen lines read back by the compose pass
+
+static INT32 cps3_pal_rgb565 = 0;	// BurnHighCol gives plain RGB565, colours can be converted with SIMD
+static UINT32 cps3_pal_dirty_start = 0;	// RamPal entries not converted to Cps3CurPal yet
+static UINT32 cps3_pal_dirty_end = 0;
+
+static UINT32 cps3_pal_line_gen[0x2000];	// cps3_pal_gen at the last change of each 16 colour line
+static UINT32 cps3_ss_gen[0x200];		// bumped when a text layer tile changes
+
+static inline void cps3_pal_written(UINT32 index, UINT32 count)
+{
+	cps3_pal_gen++;
+
+	for (UINT32 i = index >> 4; i <= ((index + count - 1) >> 4); i++)
+		cps3_pal_line_gen[i & 0x1fff] = cps3_pal_gen;
+}
+
+static UINT8 cps3_tile_opaque[0x8000];	// 0 = unknown, 1 = has transparent pixels, 2 = opaque
+
+static inline void cps3_cram_written(UINT32 offset, UINT32 length)
+{
+	if (length == 1)
+		cps3_tile_opaque[offset >> 8] = 0;
+	else
+		memset(cps3_tile_opaque + (offset >> 8), 0, (length + 0xff) >> 8);
+
+	cps3_cram_gen++;
+}
 
 
 // -- AMD/Fujitsu 29F016 --------------------------------------------------
@@ -252,28 +327,474 @@ static UINT32 cps3_mask(UINT32 address, UINT32 key1, UINT32 key2)
 	return val | (val << 16);
 }
 
+// Decrypts count words starting at address. The SIMD versions do 8 words at a
+// time: a group of 8 never crosses a 64KB boundary, so the upper half of the
+// address is the same for all of them, and the lower halves only differ in
+// bits 2-4.
+
+#if defined CPS3_SSE2
+
+#define CPS3_ROTL16(v, n)	_mm_or_si128(_mm_slli_epi16(v, n), _mm_srli_epi16(v, 16 - (n)))
+
+static inline __m128i cps3_rotxor_sse2(__m128i val, __m128i x)
+{
+	__m128i res = _mm_add_epi16(val, CPS3_ROTL16(val, 2));
+	return _mm_xor_si128(CPS3_ROTL16(res, 4), _mm_and_si128(res, _mm_xor_si128(val, x)));
+}
+
+static inline void cps3_decrypt_group(UINT32 * dst, UINT32 * src, UINT32 address)
+{
+	UINT32 a = address ^ cps3_key1;
+	__m128i ones = _mm_set1_epi16(-1);
+	__m128i k2lo = _mm_set1_epi16((INT16)(cps3_key2 & 0xffff));
+	__m128i lo = _mm_xor_si128(_mm_set1_epi16((INT16)(a & 0xffff)), _mm_setr_epi16(0, 4, 8, 12, 16, 20, 24, 28));
+
+	__m128i val = _mm_xor_si128(lo, ones);
+	val = cps3_rotxor_sse2(val, k2lo);
+	val = _mm_xor_si128(val, _mm_set1_epi16((INT16)((a >> 16) ^ 0xffff)));
+	val = cps3_rotxor_sse2(val, _mm_set1_epi16((INT16)(cps3_key2 >> 16)));
+	val = _mm_xor_si128(val, _mm_xor_si128(lo, k2lo));
+
+	__m128i * d = (__m128i *)dst;
+	__m128i * s = (__m128i *)src;
+	_mm_storeu_si128(d + 0, _mm_xor_si128(_mm_loadu_si128(s + 0), _mm_unpacklo_epi16(val, val)));
+	_mm_storeu_si128(d + 1, _mm_xor_si128(_mm_loadu_si128(s + 1), _mm_unpackhi_epi16(val, val)));
+}
+
+#elif defined CPS3_NEON
+
+#define CPS3_ROTL16(v, n)	vsriq_n_u16(vshlq_n_u16(v, n), v, 16 - (n))
+
+static inline uint16x8_t cps3_rotxor_neon(uint16x8_t val, uint16x8_t x)
+{
+	uint16x8_t res = vaddq_u16(val, CPS3_ROTL16(val, 2));
+	return veorq_u16(CPS3_ROTL16(res, 4), vandq_u16(res, veorq_u16(val, x)));
+}
+
+static inline void cps3_decrypt_group(UINT32 * dst, UINT32 * src, UINT32 address)
+{
+	static const UINT16 offsets[8] = { 0, 4, 8, 12, 16, 20, 24, 28 };
+
+	UINT32 a = address ^ cps3_key1;
+	uint16x8_t k2lo = vdupq_n_u16(cps3_key2 & 0xffff);
+	uint16x8_t lo = veorq_u16(vdupq_n_u16(a & 0xffff), vld1q_u16(offsets));
+
+	uint16x8_t val = vmvnq_u16(lo);
+	val = cps3_rotxor_neon(val, k2lo);
+	val = veorq_u16(val, vdupq_n_u16((a >> 16) ^ 0xffff));
+	val = cps3_rotxor_neon(val, vdupq_n_u16(cps3_key2 >> 16));
+	val = veorq_u16(val, veorq_u16(lo, k2lo));
+
+	uint16x8x2_t mask = vzipq_u16(val, val);
+	vst1q_u32(dst + 0, veorq_u32(vld1q_u32(src + 0), vreinterpretq_u32_u16(mask.val[0])));
+	vst1q_u32(dst + 4, veorq_u32(vld1q_u32(src + 4), vreinterpretq_u32_u16(mask.val[1])));
+}
+
+#endif
+
+static void cps3_decrypt_words(UINT32 * dst, UINT32 * src, UINT32 address, UINT32 count)
+{
+	UINT32 n = 0;
+
+#if defined CPS3_SSE2 || defined CPS3_NEON
+	for (; n < count && ((address + n * 4) & 0x1f); n++)
+		dst[n] = src[n] ^ cps3_mask(address + n * 4, cps3_key1, cps3_key2);
+
+	for (; (n + 8) <= count; n += 8)
+		cps3_decrypt_group(dst + n, src + n, address + n * 4);
+#endif
+
+	for (; n < count; n++)
+		dst[n] = src[n] ^ cps3_mask(address + n * 4, cps3_key1, cps3_key2);
+}
+
 static void cps3_decrypt_bios(void)
 {
 	UINT32 * coderegion = (UINT32 *)RomBios;
-	for (INT32 i=0; i<0x20000; i+=4) {
-		UINT32 xormask = cps3_mask(i, cps3_key1, cps3_key2);
-		/* a bit of a hack, don't decrypt the FLASH commands which are transfered by SH2 DMA */
-		if ( (i<0x1ff00) || (i>0x1ff6b) )
-			coderegion[i/4] ^= xormask;
-	}
+
+	/* a bit of a hack, don't decrypt the FLASH commands which are transfered by SH2 DMA */
+	cps3_decrypt_words(coderegion, coderegion, 0, 0x1ff00 / 4);
+	cps3_decrypt_words(coderegion + 0x1ff6c / 4, coderegion + 0x1ff6c / 4, 0x1ff6c, (0x20000 - 0x1ff6c) / 4);
+}
+
+// the program rom is split into 64KB blocks, shared out between the cores
+struct cps3_decrypt_job {
+	UINT32 * dst;
+	UINT32 * src;
+	UINT32 address;
+};
+
+static void cps3_decrypt_blocks(INT32 start, INT32 end, void * param)
+{
+	struct cps3_decrypt_job * job = (struct cps3_decrypt_job *)param;
+
+	cps3_decrypt_words(job->dst + start * 0x4000, job->src + start * 0x4000, job->address + start * 0x10000, (end - start) * 0x4000);
 }
 
+// only the "special" sets read the encrypted program rom, the others have it
+// decrypted in place
 static void cps3_decrypt_game(void)
 {
 	UINT32 * coderegion = (UINT32 *)RomGame;
 	UINT32 * decrypt_coderegion = (UINT32 *)RomGame_D;
-	
-	for (INT32 i=0; i<0x1000000; i+=4) {
-		UINT32 xormask = cps3_mask(i + 0x06000000, cps3_key1, cps3_key2);
-		decrypt_coderegion[i/4] = coderegion[i/4] ^ xormask;
+	struct cps3_decrypt_job job = { decrypt_coderegion, coderegion, 0x06000000 };
+
+	BurnParallelFor(0x1000000 / 0x10000, cps3_decrypt_blocks, &job);
+
+#if defined FBA_DEBUG
+	for (INT32 i=0; i<0x1000000 && coderegion != decrypt_coderegion; i+=4) {
+		if (decrypt_coderegion[i/4] != (coderegion[i/4] ^ cps3_mask(i + 0x06000000, cps3_key1, cps3_key2))) {
+			bprintf(PRINT_ERROR, _T("Program rom decryption differs from cps3_mask() at %08x\n"), i);
+			break;
+		}
+	}
+#endif
+}
+
+
+// Low memory mode: with cps3_user_compress set the user rom (graphics and
+// sound, up to 80MB) is kept as 64KB blocks compressed with a small LZ77
+// coder in the style of LZ4, and the blocks in use are decompressed into a
+// small LRU cache. Everything that reads the user rom goes through
+// cps3_user_data() or cps3_user_block(), which hand back RomUser itself when
+// the rom isn't compressed. The cache isn't locked, so the character DMA
+// worker isn't used in this mode. The option is only read in cps3Init(), as
+// the memory layout depends on it.
+
+#define CPS3_USER_BLOCK_SHIFT	16
+#define CPS3_USER_BLOCK_SIZE	(1 << CPS3_USER_BLOCK_SHIFT)
+#define CPS3_USER_CACHE_BLOCKS	64			// 4MB of decompressed blocks
+#define CPS3_USER_HASH_BITS	12
+
+INT32 cps3_user_compress = 0;
+static INT32 cps3_user_compressed = 0;		// cps3_user_compress as it was at init
+
+static UINT8 * cps3_user_packed = NULL;		// all the compressed blocks, back to back
+static UINT32 cps3_user_packed_size = 0;
+static UINT32 cps3_user_packed_alloc = 0;
+static UINT32 * cps3_user_offset = NULL;		// where each block starts, plus the end
+static UINT32 cps3_user_blocks = 0;
+static UINT8 * cps3_user_stage = NULL;		// the block being filled while loading
+static UINT32 cps3_user_stage_fill = 0;
+static INT32 cps3_user_error = 0;		// ran out of memory while loading
+
+static UINT8 * cps3_user_cache = NULL;
+static INT16 * cps3_user_slot = NULL;		// cache slot of each block, -1 if none
+static UINT32 cps3_user_tag[CPS3_USER_CACHE_BLOCKS];
+static UINT32 cps3_user_used[CPS3_USER_CACHE_BLOCKS];
+static UINT32 cps3_user_tick = 0;
+static UINT32 cps3_user_hits = 0;
+static UINT32 cps3_user_misses = 0;
+static UINT8 * cps3_user_window[2] = { NULL, NULL };
+static UINT32 cps3_user_window_size[2] = { 0, 0 };
+
+static UINT8 * cps3_lz_length(UINT8 * out, UINT32 length)
+{
+	for (; length >= 255; length -= 255) *out++ = 255;
+	*out++ = length;
+	return out;
+}
+
+// returns the compressed size, 0 if the block doesn't compress
+static UINT32 cps3_lz_compress(const UINT8 * src, UINT8 * dst)
+{
+	UINT16 hash[1 << CPS3_USER_HASH_BITS];
+	const UINT8 * end = src + CPS3_USER_BLOCK_SIZE;
+	const UINT8 * limit = end - 12;			// the last bytes are always literals
+	const UINT8 * anchor = src;
+	const UINT8 * p = src + 1;
+	UINT8 * out = dst;
+	UINT8 * out_limit = dst + CPS3_USER_BLOCK_SIZE - 16;
+
+	memset(hash, 0, sizeof(hash));
+
+	while (p < limit) {
+		UINT32 v = p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+		UINT32 h = (v * 2654435761U) >> (32 - CPS3_USER_HASH_BITS);
+		const UINT8 * m = src + hash[h];
+		hash[h] = (UINT16)(p - src);
+
+		if (m >= p || memcmp(m, p, 4)) {
+			p++;
+			continue;
+		}
+
+		while (p > anchor && m > src && p[-1] == m[-1]) { p--; m--; }
+
+		UINT32 literals = p - anchor;
+		UINT32 length = 4;
+		while ((p + length) < limit && p[length] == m[length]) length++;
+
+		if ((out + literals + literals / 255 + length / 255 + 8) > out_limit) return 0;
+
+		UINT8 * token = out++;
+		*token = ((literals < 15) ? literals : 15) << 4;
+		if (literals >= 15) out = cps3_lz_length(out, literals - 15);
+		memcpy(out, anchor, literals);
+		out += literals;
+
+		*out++ = (p - m) & 0xff;
+		*out++ = (p - m) >> 8;
+
+		*token |= ((length - 4) < 15) ? (length - 4) : 15;
+		if ((length - 4) >= 15) out = cps3_lz_length(out, length - 4 - 15);
+
+		p += length;
+		anchor = p;
+	}
+
+	UINT32 literals = end - anchor;
+	if ((out + literals + literals / 255 + 2) > out_limit) return 0;
+
+	*out++ = ((literals < 15) ? literals : 15) << 4;
+	if (literals >= 15) out = cps3_lz_length(out, literals - 15);
+	memcpy(out, anchor, literals);
+	out += literals;
+
+	return out - dst;
+}
+
+static void cps3_lz_decompress(const UINT8 * src, UINT8 * dst)
+{
+	UINT8 * end = dst + CPS3_USER_BLOCK_SIZE;
+
+	while (1) {
+		UINT8 token = *src++;
+		UINT32 length = token >> 4;
+
+		if (length == 15) {
+			UINT8 b;
+			do { b = *src++; length += b; } while (b == 255);
+		}
+		memcpy(dst, src, length);
+		src += length;
+		dst += length;
+
+		if (dst >= end) break;
+
+		const UINT8 * m = dst - (src[0] | (src[1] << 8));
+		src += 2;
+
+		length = token & 0x0f;
+		if (length == 15) {
+			UINT8 b;
+			do { b = *src++; length += b; } while (b == 255);
+		}
+		length += 4;
+
+		// the match may overlap what it's copying
+		while (length--) *dst++ = *m++;
+	}
+}
+
+static void cps3_user_flush()
+{
+	UINT8 * packed = cps3_user_cache;		// not in use until the roms are loaded
+	UINT32 size = cps3_lz_compress(cps3_user_stage, packed);
+	UINT8 * data = packed;
+
+	// blocks that don't compress are kept as they are
+	if (size == 0) {
+		size = CPS3_USER_BLOCK_SIZE;
+		data = cps3_user_stage;
+	}
+
+	if ((cps3_user_packed_size + size) > cps3_user_packed_alloc) {
+		UINT32 grow = cps3_user_packed_alloc + cps3_user_packed_alloc / 2 + CPS3_USER_BLOCK_SIZE;
+		UINT8 * p = (UINT8 *)realloc(cps3_user_packed, grow);
+		if (p == NULL) {
+			cps3_user_error = 1;
+			cps3_user_stage_fill = 0;
+			return;
+		}
+		cps3_user_packed = p;
+		cps3_user_packed_alloc = grow;
+	}
+
+	memcpy(cps3_user_packed + cps3_user_packed_size, data, size);
+	cps3_user_packed_size += size;
+	cps3_user_offset[++cps3_user_blocks] = cps3_user_packed_size;
+	cps3_user_stage_fill = 0;
+}
+
+static INT32 cps3_user_init()
+{
+	UINT32 count = (cps3_data_rom_size + CPS3_USER_BLOCK_SIZE - 1) >> CPS3_USER_BLOCK_SHIFT;
+
+	cps3_user_offset = (UINT32 *)BurnMalloc((count + 1) * sizeof(UINT32));
+	cps3_user_slot = (INT16 *)BurnMalloc(count * sizeof(INT16));
+	cps3_user_stage = BurnMalloc(CPS3_USER_BLOCK_SIZE);
+	cps3_user_cache = BurnMalloc(CPS3_USER_CACHE_BLOCKS * CPS3_USER_BLOCK_SIZE);
+	if (cps3_user_offset == NULL || cps3_user_slot == NULL || cps3_user_stage == NULL || cps3_user_cache == NULL) return 1;
+
+	cps3_user_packed_alloc = cps3_data_rom_size / 4;
+	cps3_user_packed = (UINT8 *)malloc(cps3_user_packed_alloc);
+	if (cps3_user_packed == NULL) return 1;
+
+	memset(cps3_user_slot, 0xff, count * sizeof(INT16));
+	for (INT32 i = 0; i < CPS3_USER_CACHE_BLOCKS; i++) {
+		cps3_user_tag[i] = ~0;
+		cps3_user_used[i] = 0;
+	}
+	cps3_user_offset[0] = 0;
+	cps3_user_blocks = 0;
+	cps3_user_packed_size = 0;
+	cps3_user_stage_fill = 0;
+	cps3_user_error = 0;
+
+	return 0;
+}
+
+// the user rom is handed over in order, in pieces of any size
+static void cps3_user_store(const UINT8 * data, UINT32 length)
+{
+	while (length) {
+		UINT32 n = CPS3_USER_BLOCK_SIZE - cps3_user_stage_fill;
+		if (n > length) n = length;
+
+		memcpy(cps3_user_stage + cps3_user_stage_fill, data, n);
+		cps3_user_stage_fill += n;
+		data += n;
+		length -= n;
+
+		if (cps3_user_stage_fill == CPS3_USER_BLOCK_SIZE) cps3_user_flush();
+	}
+}
+
+// pads out to the full user rom size (the CHD sets have no roms at all)
+static INT32 cps3_user_finish()
+{
+	UINT32 count = (cps3_data_rom_size + CPS3_USER_BLOCK_SIZE - 1) >> CPS3_USER_BLOCK_SHIFT;
+
+	while (cps3_user_blocks < count && !cps3_user_error) {
+		memset(cps3_user_stage + cps3_user_stage_fill, 0, CPS3_USER_BLOCK_SIZE - cps3_user_stage_fill);
+		cps3_user_stage_fill = CPS3_USER_BLOCK_SIZE;
+
+		cps3_user_flush();
+	}
+
+	if (cps3_user_error) {
+		bprintf(PRINT_ERROR, _T("Not enough memory for the compressed user rom\n"));
+		return 1;
+	}
+
+	UINT8 * p = (UINT8 *)realloc(cps3_user_packed, cps3_user_packed_size);
+	if (p) cps3_user_packed = p;
+
+	BurnFree(cps3_user_stage);
+
+	bprintf(PRINT_NORMAL, _T("User rom compressed from %d to %d bytes\n"), cps3_data_rom_size, cps3_user_packed_size);
+
+	return 0;
+}
+
+static void cps3_user_exit()
+{
+	if (cps3_user_hits || cps3_user_misses) {
+		bprintf(PRINT_NORMAL, _T("User rom cache: %d hits, %d misses, %d%% hit rate\n"),
+			cps3_user_hits, cps3_user_misses, (INT32)((UINT64)cps3_user_hits * 100 / (cps3_user_hits + cps3_user_misses)));
+	}
+
+	if (cps3_user_packed) {
+		free(cps3_user_packed);
+		cps3_user_packed = NULL;
+	}
+
+	BurnFree(cps3_user_offset);
+	BurnFree(cps3_user_slot);
+	BurnFree(cps3_user_stage);
+	BurnFree(cps3_user_cache);
+
+	for (INT32 i = 0; i < 2; i++) {
+		if (cps3_user_window[i]) {
+			free(cps3_user_window[i]);
+			cps3_user_window[i] = NULL;
+		}
+		cps3_user_window_size[i] = 0;
+	}
+
+	cps3_user_packed_size = 0;
+	cps3_user_packed_alloc = 0;
+	cps3_user_blocks = 0;
+	cps3_user_tick = 0;
+	cps3_user_hits = 0;
+	cps3_user_misses = 0;
+}
+
+// the decompressed block, valid until CPS3_USER_CACHE_BLOCKS - 1 other blocks
+// have been asked for
+UINT8 * cps3_user_block(UINT32 block)
+{
+	static UINT8 zero[CPS3_USER_BLOCK_SIZE];
+
+	if (block >= cps3_user_blocks) return zero;
+
+	INT32 slot = cps3_user_slot[block];
+	if (slot >= 0) {
+		cps3_user_used[slot] = ++cps3_user_tick;
+		cps3_user_hits++;
+		return cps3_user_cache + (slot << CPS3_USER_BLOCK_SHIFT);
+	}
+
+	slot = 0;
+	for (INT32 i = 1; i < CPS3_USER_CACHE_BLOCKS; i++) {
+		if (cps3_user_used[i] < cps3_user_used[slot]) slot = i;
+	}
+
+	if (cps3_user_tag[slot] != ~0U) cps3_user_slot[cps3_user_tag[slot]] = -1;
+	cps3_user_tag[slot] = block;
+	cps3_user_slot[block] = slot;
+	cps3_user_used[slot] = ++cps3_user_tick;
+	cps3_user_misses++;
+
+	UINT8 * dst = cps3_user_cache + (slot << CPS3_USER_BLOCK_SHIFT);
+	UINT8 * src = cps3_user_packed + cps3_user_offset[block];
+
+	if ((cps3_user_offset[block + 1] - cps3_user_offset[block]) == CPS3_USER_BLOCK_SIZE) {
+		memcpy(dst, src, CPS3_USER_BLOCK_SIZE);
+	} else {
+		cps3_lz_decompress(src, dst);
 	}
+
+	return dst;
 }
 
+// Returns p with p[offset] to p[offset + length - 1] readable, like RomUser.
+// Ranges spanning blocks are put together in one of two windows, so two
+// ranges (a transfer and its table) can be in use at once. NULL if there's
+// no memory for the window, the transfer is then dropped.
+static UINT8 * cps3_user_data(UINT32 offset, UINT32 length, INT32 window)
+{
+	if (!cps3_user_compressed) return RomUser;
+	if (length == 0) length = 1;
+
+	UINT32 first = offset >> CPS3_USER_BLOCK_SHIFT;
+	UINT32 last = (offset + length - 1) >> CPS3_USER_BLOCK_SHIFT;
+
+	if (window == 0 && first == last) {
+		return cps3_user_block(first) - (first << CPS3_USER_BLOCK_SHIFT);
+	}
+
+	if (length > cps3_user_window_size[window]) {
+		UINT8 * p = (UINT8 *)realloc(cps3_user_window[window], length);
+		if (p == NULL) return NULL;
+
+		cps3_user_window[window] = p;
+		cps3_user_window_size[window] = length;
+	}
+
+	UINT8 * dst = cps3_user_window[window];
+	for (UINT32 done = 0; done < length; ) {
+		UINT32 in_block = (offset + done) & (CPS3_USER_BLOCK_SIZE - 1);
+		UINT32 n = CPS3_USER_BLOCK_SIZE - in_block;
+		if (n > (length - done)) n = length - done;
+
+		memcpy(dst + done, cps3_user_block((offset + done) >> CPS3_USER_BLOCK_SHIFT) + in_block, n);
+		done += n;
+	}
+
+	return dst - offset;
+}
 
 static INT32 last_normal_byte = 0;
 
@@ -319,9 +840,12 @@ static UINT32 process_byte( UINT8 real_byte, UINT32 destination, INT32 max_lengt
 	}
 }
 
-static void cps3_do_char_dma( UINT32 real_source, UINT32 real_destination, UINT32 real_length )
+static void cps3_do_char_dma( UINT32 real_source, UINT32 real_destination, UINT32 real_length, UINT32 table )
 {
-	UINT8 * sourcedata = RomUser;
+	UINT8 * sourcedata = cps3_user_data(real_source, real_length + 16, 0);
+	UINT8 * tabledata = cps3_user_data(table, 0x100, 1);
+	if (sourcedata == NULL || tabledata == NULL) return;
+
 	INT32 length_remaining = real_length;
 	last_normal_byte = 0;
 	while (length_remaining) {
@@ -333,7 +857,7 @@ static void cps3_do_char_dma( UINT32 real_source, UINT32 real_destination, UINT3
 			UINT32 length_processed;
 			current_byte &= 0x7f;
 
-			real_byte = sourcedata[ (chardma_table_address+current_byte*2+0) ^ 0 ];
+			real_byte = tabledata[ (table+current_byte*2+0) ^ 0 ];
 			//if (real_byte&0x80) return;
 			length_processed = process_byte( real_byte, real_destination, length_remaining );
 			length_remaining -= length_processed; // subtract the number of bytes the operation has taken
@@ -341,7 +865,7 @@ static void cps3_do_char_dma( UINT32 real_source, UINT32 real_destination, UINT3
 			if (real_destination>0x7fffff) return;
 			if (length_remaining<=0) return; // if we've expired, exit
 
-			real_byte = sourcedata[ (chardma_table_address+current_byte*2+1) ^ 0 ];
+			real_byte = tabledata[ (table+current_byte*2+1) ^ 0 ];
 			//if (real_byte&0x80) return;
 			length_processed = process_byte( real_byte, real_destination, length_remaining );
 			length_remaining -= length_processed; // subtract the number of bytes the operation has taken
@@ -398,9 +922,13 @@ static UINT32 ProcessByte8(UINT8 b, UINT32 dst_offset)
  	}
 }
 
-static void cps3_do_alt_char_dma(UINT32 src, UINT32 real_dest, UINT32 real_length )
+static void cps3_do_alt_char_dma(UINT32 src, UINT32 real_dest, UINT32 real_length, UINT32 table )
 {
-	UINT8 * px = RomUser;
+	// at worst every other byte is an empty run
+	UINT8 * px = cps3_user_data(src, real_length * 9 / 4 + 32, 0);
+	UINT8 * tx = cps3_user_data(table, 0x100, 1);
+	if (px == NULL || tx == NULL) return;
+
 	UINT32 start = real_dest;
 	UINT32 ds = real_dest;
 
@@ -411,81 +939,949 @@ static void cps3_do_alt_char_dma(UINT32 src, UINT32 real_dest, UINT32 real_lengt
 		UINT8 ctrl=px[ src ^ 0 ];
  		++src;
 
-		for(INT32 i=0;i<8;++i) {
-			UINT8 p = px[ src ^ 0 ];
+		for(INT32 i=0;i<8;++i) {
+			UINT8 p = px[ src ^ 0 ];
+
+			if(ctrl&0x80) {
+				UINT8 real_byte;
+				p &= 0x7f;
+				real_byte = tx[ (table+p*2+0) ^ 0 ];
+				ds += ProcessByte8(real_byte,ds);
+				real_byte = tx[ (table+p*2+1) ^ 0 ];
+				ds += ProcessByte8(real_byte,ds);
+ 			} else {
+ 				ds += ProcessByte8(p,ds);
+ 			}
+ 			++src;
+ 			ctrl<<=1;
+
+			if((ds-start)>=real_length)
+				return;
+ 		}
+	}
+}
+
+// Faster decoders for the two compressed formats. Runs are filled and
+// literal spans copied in one go, and as long as a transfer can't reach the
+// end of character RAM no masking or bounds checks are needed. They give the
+// same result as the byte at a time decoders above, which still handle the
+// transfers that can.
+
+static inline void cps3_cram_fill(UINT8 * dest, UINT32 offset, UINT8 value, UINT32 length)
+{
+#if BE_GFX
+	memset(dest + offset, value, length);
+#else
+	while (length--) { dest[offset ^ 3] = value; offset++; }
+#endif
+}
+
+static inline void cps3_cram_copy(UINT8 * dest, UINT32 offset, UINT8 * src, UINT32 length)
+{
+#if BE_GFX
+	memcpy(dest + offset, src, length);
+#else
+	while (length--) { dest[offset ^ 3] = *src++; offset++; }
+#endif
+}
+
+// non-zero if a transfer with the given overshoot can't reach the end of character RAM
+static inline INT32 cps3_char_dma_in_range(UINT32 destination, UINT32 length, UINT32 slack)
+{
+	return (destination <= 0x7fffff) && ((destination + length + slack) <= 0x800000);
+}
+
+static inline UINT32 cps3_char_dma_op(UINT8 * dest, UINT32 offset, UINT8 real_byte, UINT8 * last)
+{
+	if (real_byte & 0x40) {
+		UINT32 length = (real_byte & 0x3f) + 1;
+		cps3_cram_fill(dest, offset, *last & 0x3f, length);
+		return offset + length;
+	}
+
+#if BE_GFX
+	dest[offset] = real_byte;
+#else
+	dest[offset ^ 3] = real_byte;
+#endif
+	*last = real_byte;
+	return offset + 1;
+}
+
+// returns the number of bytes written, or 0 if the slow decoder had to be used
+static UINT32 cps3_do_char_dma_fast(UINT32 real_source, UINT32 real_destination, UINT32 real_length, UINT32 table)
+{
+	// a run may go up to 63 bytes past the end of the transfer
+	if (!cps3_char_dma_in_range(real_destination, real_length, 64)) {
+		cps3_do_char_dma(real_source, real_destination, real_length, table);
+		return 0;
+	}
+
+	UINT8 * sourcedata = cps3_user_data(real_source, real_length + 16, 0);
+	UINT8 * tabledata = cps3_user_data(table, 0x100, 1);
+	if (sourcedata == NULL || tabledata == NULL) return 0;
+
+	UINT8 * dest = (UINT8 *) RamCRam;
+	UINT32 end = real_destination + real_length;
+	UINT32 offset = real_destination;
+	UINT8 last = 0;
+
+	while (offset < end) {
+		UINT8 current_byte = sourcedata[real_source++];
+
+		if (current_byte & 0x80) {
+			current_byte &= 0x7f;
+			offset = cps3_char_dma_op(dest, offset, tabledata[table + current_byte * 2 + 0], &last);
+			if (offset >= end) break;
+			offset = cps3_char_dma_op(dest, offset, tabledata[table + current_byte * 2 + 1], &last);
+		} else if (current_byte & 0x40) {
+			offset = cps3_char_dma_op(dest, offset, current_byte, &last);
+		} else {
+			UINT8 * literal = sourcedata + real_source - 1;
+			UINT32 length = 1;
+
+			while ((offset + length) < end && !(literal[length] & 0xc0)) length++;
+
+			cps3_cram_copy(dest, offset, literal, length);
+			last = literal[length - 1];
+			real_source += length - 1;
+			offset += length;
+		}
+	}
+
+	return offset - real_destination;
+}
+
+static inline UINT32 cps3_alt_char_dma_op(UINT8 * dest, UINT32 offset, UINT8 b, UINT16 * last, UINT16 * last2)
+{
+	if (*last == *last2) {
+		UINT32 rle = (b + 1) & 0xff;
+		cps3_cram_fill(dest, offset, (UINT8)*last, rle);
+		*last2 = 0xffff;
+		return offset + rle;
+	}
+
+	*last2 = *last;
+	*last = b;
+#if BE_GFX
+	dest[offset] = b;
+#else
+	dest[offset ^ 3] = b;
+#endif
+	return offset + 1;
+}
+
+static UINT32 cps3_do_alt_char_dma_fast(UINT32 src, UINT32 real_dest, UINT32 real_length, UINT32 table)
+{
+	// a table entry may expand to two 255 byte runs past the end of the transfer
+	if (!cps3_char_dma_in_range(real_dest, real_length, 512)) {
+		cps3_do_alt_char_dma(src, real_dest, real_length, table);
+		return 0;
+	}
+
+	UINT8 * px = cps3_user_data(src, real_length * 9 / 4 + 32, 0);
+	UINT8 * tx = cps3_user_data(table, 0x100, 1);
+	if (px == NULL || tx == NULL) return 0;
+
+	UINT8 * dest = (UINT8 *) RamCRam;
+	UINT32 end = real_dest + real_length;
+	UINT32 ds = real_dest;
+	UINT16 last = 0xfffe;
+	UINT16 last2 = 0xffff;
+
+	while (1) {
+		UINT8 ctrl = px[src++];
+
+		for (INT32 i = 0; i < 8; i++, src++, ctrl <<= 1) {
+			UINT8 p = px[src];
+
+			if (ctrl & 0x80) {
+				p &= 0x7f;
+				ds = cps3_alt_char_dma_op(dest, ds, tx[table + p * 2 + 0], &last, &last2);
+				ds = cps3_alt_char_dma_op(dest, ds, tx[table + p * 2 + 1], &last, &last2);
+			} else {
+				ds = cps3_alt_char_dma_op(dest, ds, p, &last, &last2);
+			}
+
+			if (ds >= end) return ds - real_dest;
+		}
+	}
+}
+
+// Games decompress the same graphics again and again (every round start,
+// character select, ...), so the output of the decoders is kept, keyed by
+// where it came from. The user rom never changes, and transfers which took
+// the fast path don't depend on their destination.
+
+#ifdef WII_VM
+#define CPS3_CHARDMA_CACHE_BUDGET	(1 * 1024 * 1024)
+#else
+#define CPS3_CHARDMA_CACHE_BUDGET	(16 * 1024 * 1024)
+#endif
+#define CPS3_CHARDMA_CACHE_ENTRIES	256
+#define CPS3_CHARDMA_CACHE_MIN		0x400		// smaller transfers aren't worth it
+
+struct cps3_chardma_entry {
+	UINT32 source;
+	UINT32 table;
+	UINT32 length;
+	INT32 mode;			// 0 = 6bpp, 1 = 8bpp
+	UINT32 size;			// bytes of output, 0 for unused entries
+	UINT32 used;
+	INT32 disk;			// loaded from the cache file
+	UINT8 * data;
+};
+
+static struct cps3_chardma_entry cps3_chardma_cache[CPS3_CHARDMA_CACHE_ENTRIES];
+static UINT32 cps3_chardma_cache_total = 0;
+static UINT32 cps3_chardma_cache_tick = 0;
+static UINT32 cps3_chardma_cache_hits = 0;
+static UINT32 cps3_chardma_cache_misses = 0;
+
+// The cache can also be kept on disk between sessions, so graphics a game has
+// used before are never decompressed again. Which transfers a game makes is
+// only known once its code builds the DMA lists, so the file fills up as the
+// game is played rather than in one pass at load time.
+
+#define CPS3_CHARDMA_FILE_MAGIC		0x44524843	// "CHRD"
+#define CPS3_CHARDMA_FILE_VERSION	1
+
+INT32 cps3_chardma_disk_cache = 0;
+static UINT32 cps3_chardma_cache_disk_hits = 0;
+
+// <game><ext> in the save directory (MAX_PATH long), non-zero if it doesn't fit
+static INT32 cps3_cache_filename(TCHAR * szFilename, const TCHAR * szExt)
+{
+#ifdef __LIBRETRO__
+#ifdef _WIN32
+   char slash = '\\';
+#else
+   char slash = '/';
+#endif
+	INT32 nLen = snprintf(szFilename, MAX_PATH, "%s%c%s%s", g_save_dir, slash, BurnDrvGetText(DRV_NAME), szExt);
+	if (nLen < 0 || nLen >= MAX_PATH) return 1;
+#else
+	if (_tcslen(szAppHiscorePath) + _tcslen(BurnDrvGetText(DRV_NAME)) + _tcslen(szExt) >= MAX_PATH) return 1;
+	_stprintf(szFilename, _T("%s%s%s"), szAppHiscorePath, BurnDrvGetText(DRV_NAME), szExt);
+#endif
+
+	return 0;
+}
+
+// identifies the roms a cache file was made from, including the files they
+// were read from so that replacing them (or a bad dump loaded by name) is noticed
+static UINT32 cps3_rom_id()
+{
+	struct BurnRomInfo ri;
+	UINT32 id = cps3_data_rom_size;
+
+	for (INT32 i = 0; BurnDrvGetRomInfo(&ri, i) == 0; i++) {
+		id = ((id << 5) | (id >> 27)) ^ ri.nCrc ^ ri.nLen;
+		if (BurnExtRomStamp) id = ((id << 5) | (id >> 27)) ^ BurnExtRomStamp(i);
+	}
+
+	return id;
+}
+
+static void cps3_chardma_cache_load()
+{
+	if (!cps3_chardma_disk_cache || !BE_GFX) return;
+
+	TCHAR szFilename[MAX_PATH];
+	if (cps3_cache_filename(szFilename, _T(".chr"))) return;
+
+	FILE * fp = _tfopen(szFilename, _T("rb"));
+	if (fp == NULL) return;
+
+	UINT32 header[4];
+	INT32 loaded = 0;
+
+	if (fread(header, sizeof(header), 1, fp) == 1 && header[0] == CPS3_CHARDMA_FILE_MAGIC && header[1] == CPS3_CHARDMA_FILE_VERSION && header[2] == cps3_rom_id()) {
+		UINT32 count = header[3];
+
+		// entries are stored most recently used first
+		for (UINT32 i = 0; i < count && i < CPS3_CHARDMA_CACHE_ENTRIES; i++) {
+			struct cps3_chardma_entry * e = &cps3_chardma_cache[i];
+			UINT32 info[5];		// source, table, length, mode, size
+
+			if (fread(info, sizeof(info), 1, fp) != 1) break;
+			// no more than the decoders can write for that transfer
+			if (info[3] > 1 || info[4] == 0 || info[4] > info[2] + (info[3] ? 512 : 64)) break;
+			if ((cps3_chardma_cache_total + info[4]) > CPS3_CHARDMA_CACHE_BUDGET) break;
+
+			e->data = (UINT8 *)malloc(info[4]);
+			if (e->data == NULL) break;
+
+			if (fread(e->data, info[4], 1, fp) != 1) {
+				free(e->data);
+				e->data = NULL;
+				break;
+			}
+
+			e->source = info[0];
+			e->table = info[1];
+			e->length = info[2];
+			e->mode = info[3];
+			e->size = info[4];
+			e->used = count - i;
+			e->disk = 1;
+			cps3_chardma_cache_total += e->size;
+			loaded++;
+		}
+
+		cps3_chardma_cache_tick = count;
+	}
+
+	fclose(fp);
+
+	bprintf(PRINT_NORMAL, _T("Character DMA cache: %d transfers loaded from %s\n"), loaded, szFilename);
+}
+
+static void cps3_chardma_cache_save()
+{
+	// only rewrite the file if something was added
+	if (!cps3_chardma_disk_cache || !BE_GFX || cps3_chardma_cache_misses == 0) return;
+
+	struct cps3_chardma_entry * order[CPS3_CHARDMA_CACHE_ENTRIES];
+	UINT32 count = 0;
+
+	for (INT32 i = 0; i < CPS3_CHARDMA_CACHE_ENTRIES; i++) {
+		struct cps3_chardma_entry * e = &cps3_chardma_cache[i];
+		if (e->size == 0) continue;
+
+		// most recently used first
+		UINT32 j = count++;
+		while (j && order[j - 1]->used < e->used) {
+			order[j] = order[j - 1];
+			j--;
+		}
+		order[j] = e;
+	}
+
+	TCHAR szFilename[MAX_PATH];
+	if (cps3_cache_filename(szFilename, _T(".chr"))) return;
+
+	FILE * fp = _tfopen(szFilename, _T("wb"));
+	if (fp == NULL) return;
+
+	UINT32 header[4] = { CPS3_CHARDMA_FILE_MAGIC, CPS3_CHARDMA_FILE_VERSION, cps3_rom_id(), count };
+	fwrite(header, sizeof(header), 1, fp);
+
+	for (UINT32 i = 0; i < count; i++) {
+		UINT32 info[5] = { order[i]->source, order[i]->table, order[i]->length, (UINT32)order[i]->mode, order[i]->size };
+		fwrite(info, sizeof(info), 1, fp);
+		fwrite(order[i]->data, order[i]->size, 1, fp);
+	}
+
+	fclose(fp);
+}
+
+static void cps3_chardma_cache_exit()
+{
+	if (cps3_chardma_cache_hits || cps3_chardma_cache_misses) {
+		bprintf(PRINT_NORMAL, _T("Character DMA cache: %d hits (%d from disk), %d misses, %d%% hit rate, %d bytes in use\n"),
+			cps3_chardma_cache_hits, cps3_chardma_cache_disk_hits, cps3_chardma_cache_misses,
+			cps3_chardma_cache_hits * 100 / (cps3_chardma_cache_hits + cps3_chardma_cache_misses), cps3_chardma_cache_total);
+	}
+
+	cps3_chardma_cache_save();
+
+	for (INT32 i = 0; i < CPS3_CHARDMA_CACHE_ENTRIES; i++) {
+		free(cps3_chardma_cache[i].data);
+	}
+
+	memset(cps3_chardma_cache, 0, sizeof(cps3_chardma_cache));
+	cps3_chardma_cache_total = 0;
+	cps3_chardma_cache_tick = 0;
+	cps3_chardma_cache_hits = 0;
+	cps3_chardma_cache_misses = 0;
+	cps3_chardma_cache_disk_hits = 0;
+}
+
+static void cps3_chardma_cache_add(INT32 mode, UINT32 source, UINT32 length, UINT32 table, UINT32 destination, UINT32 size)
+{
+	if (size > CPS3_CHARDMA_CACHE_BUDGET) return;
+
+	// make room, dropping the least recently used entries
+	struct cps3_chardma_entry * e;
+	while (1) {
+		struct cps3_chardma_entry * oldest = NULL;
+		e = NULL;
+
+		for (INT32 i = 0; i < CPS3_CHARDMA_CACHE_ENTRIES; i++) {
+			struct cps3_chardma_entry * c = &cps3_chardma_cache[i];
+			if (c->size == 0) {
+				if (e == NULL) e = c;
+			} else if (oldest == NULL || c->used < oldest->used) {
+				oldest = c;
+			}
+		}
+
+		if (e && (cps3_chardma_cache_total + size) <= CPS3_CHARDMA_CACHE_BUDGET) break;
+
+		cps3_chardma_cache_total -= oldest->size;
+		oldest->size = 0;
+		free(oldest->data);
+		oldest->data = NULL;
+	}
+
+	e->data = (UINT8 *)malloc(size);
+	if (e->data == NULL) return;
+
+	memcpy(e->data, (UINT8 *)RamCRam + destination, size);
+	e->source = source;
+	e->table = table;
+	e->length = length;
+	e->mode = mode;
+	e->size = size;
+	e->used = ++cps3_chardma_cache_tick;
+	e->disk = 0;
+	cps3_chardma_cache_total += size;
+}
+
+// (the output is kept as a plain byte range, so this needs unswizzled character RAM)
+static void cps3_do_char_dma_cached(INT32 mode, UINT32 source, UINT32 destination, UINT32 length, UINT32 table)
+{
+	if (BE_GFX && length >= CPS3_CHARDMA_CACHE_MIN && cps3_char_dma_in_range(destination, length, mode ? 512 : 64)) {
+		for (INT32 i = 0; i < CPS3_CHARDMA_CACHE_ENTRIES; i++) {
+			struct cps3_chardma_entry * e = &cps3_chardma_cache[i];
+			if (e->size && e->source == source && e->length == length && e->mode == mode && e->table == table) {
+				// a bad entry from the cache file is dropped and done again
+				if (!cps3_char_dma_in_range(destination, e->size, 0)) {
+					cps3_chardma_cache_total -= e->size;
+					e->size = 0;
+					free(e->data);
+					e->data = NULL;
+					break;
+				}
+				memcpy((UINT8 *)RamCRam + destination, e->data, e->size);
+				e->used = ++cps3_chardma_cache_tick;
+				cps3_chardma_cache_hits++;
+				if (e->disk) cps3_chardma_cache_disk_hits++;
+				return;
+			}
+		}
+	}
+
+	UINT32 size = mode ? cps3_do_alt_char_dma_fast(source, destination, length, table) : cps3_do_char_dma_fast(source, destination, length, table);
+
+	if (BE_GFX && length >= CPS3_CHARDMA_CACHE_MIN && size) {
+		cps3_chardma_cache_misses++;
+		cps3_chardma_cache_add(mode, source, length, table, destination, size);
+	}
+}
+
+// Character DMA lists are decoded on a worker thread where there is one. The
+// list itself is still read straight away and IRQ 10 raised at the same point,
+// so only the host side timing changes. Until the worker is done, reads and
+// writes of the character RAM it may be writing (and anything else using
+// character RAM, like drawing or savestates) wait for it in cps3_chardma_sync().
+// The worker may allocate cache entries, so those use malloc() and free()
+// rather than BurnMalloc(), whose table isn't thread safe.
+
+struct cps3_chardma_job {
+	INT32 type;			// 0 = 6bpp, 1 = 8bpp, 2 = plain copy
+	UINT32 source;
+	UINT32 destination;
+	UINT32 length;
+	UINT32 table;
+};
+
+static struct cps3_chardma_job cps3_chardma_jobs[0x1000 / 3 + 1];
+static INT32 cps3_chardma_job_count = 0;
+static BurnWorker * cps3_chardma_worker = NULL;
+static INT32 cps3_chardma_pending = 0;		// the jobs are on the worker
+static UINT32 cps3_chardma_busy_start = 0;	// RamCRam bytes they may write
+static UINT32 cps3_chardma_busy_end = 0;
+
+static void cps3_map_cram();
+
+static void cps3_run_chardma_jobs(void *)
+{
+	for (INT32 i = 0; i < cps3_chardma_job_count; i++) {
+		struct cps3_chardma_job * j = &cps3_chardma_jobs[i];
+
+		if (j->type == 2) {
+			UINT8 * data = cps3_user_data(j->source, j->length, 0);
+			if (data) memcpy( (UINT8 *)RamCRam + j->destination, data + j->source, j->length );
+		} else {
+			cps3_do_char_dma_cached( j->type, j->source, j->destination, j->length, j->table );
+		}
+	}
+}
+
+static void cps3_chardma_sync()
+{
+	if (!cps3_chardma_pending) return;
+
+	BurnWorkerWait(cps3_chardma_worker);
+
+	cps3_chardma_pending = 0;
+	cps3_chardma_job_count = 0;
+	cps3_map_cram();
+}
+
+static inline void cps3_chardma_wait(UINT32 addr, UINT32 size)
+{
+	if (cps3_chardma_pending && (addr + size) > cps3_chardma_busy_start && addr < cps3_chardma_busy_end)
+		cps3_chardma_sync();
+}
+
+static void cps3_chardma_queue(INT32 type, UINT32 source, UINT32 destination, UINT32 length, UINT32 list_start, UINT32 list_end)
+{
+	struct cps3_chardma_job * j = &cps3_chardma_jobs[cps3_chardma_job_count++];
+
+	j->type = type;
+	j->source = source;
+	j->destination = destination;
+	j->length = length;
+	j->table = chardma_table_address;
+
+	// the decoders can overshoot the transfer a little
+	UINT32 slack = (type == 2) ? 0 : (type ? 512 : 64);
+	UINT32 end = destination + length + slack;
+
+	// transfers which could wrap or write over the rest of the list are done
+	// now, in order with what's queued before them
+	if (cps3_chardma_worker == NULL || !cps3_char_dma_in_range(destination, length, slack) || (end > list_start && destination < list_end)) {
+		cps3_run_chardma_jobs(NULL);
+		cps3_chardma_job_count = 0;
+		return;
+	}
+
+	if (cps3_chardma_job_count == 1 || destination < cps3_chardma_busy_start) cps3_chardma_busy_start = destination;
+	if (cps3_chardma_job_count == 1 || end > cps3_chardma_busy_end) cps3_chardma_busy_end = end;
+}
+
+static void cps3_process_character_dma(UINT32 address)
+{
+	// the list lives in character RAM too
+	cps3_chardma_sync();
+	cps3_cram_written(0, 0x800000);
+
+	UINT32 list_start = address << 2;
+	UINT32 list_end = (address + 0x1002) << 2;
+
+	for (INT32 i=0; i<0x1000; i+=3) {
+		UINT32 dat1 = RamCRam[i+0+(address)];
+		UINT32 dat2 = RamCRam[i+1+(address)];
+		UINT32 dat3 = RamCRam[i+2+(address)];
+		UINT32 real_source      = (dat3<<1)-0x400000;
+		UINT32 real_destination =  dat2<<3;
+		UINT32 real_length      = (((dat1&0x001fffff)+1)<<3);
+		
+		if (dat1==0x01000000) break;	// end of list marker
+		if (dat1==0x13131313) break;	// our default fill
+		
+		switch ( dat1 & 0x00e00000 ) {
+		case 0x00800000:
+			chardma_table_address = real_source;
+			Sh2SetIRQLine(10, SH2_IRQSTATUS_AUTO);
+			break;
+		case 0x00400000:
+			cps3_chardma_queue( 0, real_source, real_destination, real_length, list_start, list_end );
+			Sh2SetIRQLine(10, SH2_IRQSTATUS_AUTO);
+			break;
+		case 0x00600000:
+			//bprintf(PRINT_NORMAL, _T("Character DMA (alt) start %08x to %08x with %d\n"), real_source, real_destination, real_length);
+			/* 8bpp DMA decompression
+			   - this is used on SFIII NG Sean's Stage ONLY */
+			cps3_chardma_queue( 1, real_source, real_destination, real_length, list_start, list_end );
+			Sh2SetIRQLine(10, SH2_IRQSTATUS_AUTO);
+			break;
+		case 0x00000000:
+			// Red Earth need this. 8192 byte trans to 0x00003000 (from 0x007ec000???)
+			// seems some stars(6bit alpha) without compress
+			//bprintf(PRINT_NORMAL, _T("Character DMA (redearth) start %08x to %08x with %d\n"), real_source, real_destination, real_length);
+			cps3_chardma_queue( 2, real_source, real_destination, real_length, list_start, list_end );
+			Sh2SetIRQLine(10, SH2_IRQSTATUS_AUTO);
+			break;
+		default:
+			bprintf(PRINT_NORMAL, _T("Character DMA Unknown DMA List Command Type %08x\n"), dat1);
+		}
+	}
+
+	if (cps3_chardma_job_count) {
+		cps3_chardma_pending = 1;
+		BurnWorkerSubmit(cps3_chardma_worker, cps3_run_chardma_jobs, NULL);
+		cps3_map_cram();
+	}
+}
+
+#ifndef WII_VM
+
+// Prepared rom cache
+//
+// Getting the roms ready means inflating, interleaving, byteswapping and
+// decrypting 100MB or so every time a game is started. With cps3_rom_cache
+// set the finished images are written to <game>.rom in the save directory and
+// used from there next time. On Linux the file is mapped straight into place,
+// so starting is almost instant and the pages are shared through the page
+// cache. The mapping is private, so flash writes and savestates only ever
+// change our own copy of a page.
+
+#define CPS3_ROM_CACHE_MAGIC		0x4d4f5243	// "CROM"
+#define CPS3_ROM_CACHE_VERSION		2
+#define CPS3_ROM_CACHE_HEADER		0x1000		// the images start on a page boundary
+
+struct cps3_rom_cache_header {
+	UINT32 magic;
+	UINT32 version;
+	UINT32 burn_version;
+	UINT32 rom_id;
+	UINT32 data_rom_size;
+	UINT32 byte_order;		// 0x01020304 as written by the host that made the file
+	char name[32];
+};
+
+INT32 cps3_rom_cache = 0;
+INT32 cps3_rom_share = 0;
+static INT32 cps3_rom_cached = 0;		// the images don't need loading
+static UINT8 * cps3_rom_map = NULL;
+static UINT32 cps3_rom_map_size = 0;
+static FILE * cps3_rom_file = NULL;
+
+static UINT32 cps3_rom_cache_size()
+{
+	return CPS3_ROM_CACHE_HEADER + 0x0080000 + (cps3_isSpecial ? 0x2000000 : 0x1000000) + cps3_data_rom_size;
+}
+
+static void cps3_rom_cache_header_init(struct cps3_rom_cache_header * header)
+{
+	memset(header, 0, sizeof(*header));
+	header->magic = CPS3_ROM_CACHE_MAGIC;
+	header->version = CPS3_ROM_CACHE_VERSION;
+	header->burn_version = nBurnVer;
+	header->rom_id = cps3_rom_id();
+	header->data_rom_size = cps3_data_rom_size;
+	header->byte_order = 0x01020304;
+	strncpy(header->name, BurnDrvGetTextA(DRV_NAME), sizeof(header->name) - 1);
+}
+
+#if defined CPS3_ROM_SHARE
+
+// With cps3_rom_share set the images are kept in a POSIX shared memory object
+// named after the game and its roms. The first instance creates it and loads
+// the roms into it, writing the header last to tell the others they are
+// ready; instances started after that map it rather than loading their own.
+// Everyone, the first instance included once it's done, ends up with a
+// private mapping, so flash writes and savestates never leak into the shared
+// copy. The object stays around after the last instance quits, to be picked
+// up by the next one. Objects left by other versions or other rom files of
+// the same game are removed when a new one is made, so only one is kept.
+//
+// The instance loading the roms holds an flock() on the object until it has
+// written the header, so the others wait for as long as it is alive and only
+// start over with a new object once the lock is free and the header still
+// isn't there (it quit or crashed half way).
+
+static INT32 cps3_rom_share_fd = -1;		// object we created and are still loading, locked
+static char cps3_rom_share_name[64];
+
+// non-zero if fd holds finished roms
+static INT32 cps3_rom_share_ready(INT32 fd, UINT32 size)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (UINT32)st.st_size != size) return 0;
+
+	const UINT8 * header = (const UINT8 *)mmap(NULL, CPS3_ROM_CACHE_HEADER, PROT_READ, MAP_SHARED, fd, 0);
+	if ((void *)header == MAP_FAILED) return 0;
+
+	struct cps3_rom_cache_header want;
+	cps3_rom_cache_header_init(&want);
+
+	INT32 ready = (memcmp(header, &want, sizeof(want)) == 0);
+	munmap((void *)header, CPS3_ROM_CACHE_HEADER);
+
+	return ready;
+}
+
+// non-zero if fd is still the object the name refers to
+static INT32 cps3_rom_share_current(INT32 fd)
+{
+	INT32 now = shm_open(cps3_rom_share_name, O_RDONLY, 0);
+	if (now < 0) return 0;
+
+	struct stat a, b;
+	INT32 same = (fstat(fd, &a) == 0 && fstat(now, &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino);
+	close(now);
+
+	return same;
+}
+
+// remove the objects of this game other than ours (instances still using one
+// keep their mapping, only the name goes)
+static void cps3_rom_share_reclaim()
+{
+	char prefix[64];
+	snprintf(prefix, sizeof(prefix), "fba-cps3-%s-", BurnDrvGetTextA(DRV_NAME));
+
+	DIR * dir = opendir("/dev/shm");
+	if (dir == NULL) return;
+
+	struct dirent * entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, prefix, strlen(prefix)) || strcmp(entry->d_name, cps3_rom_share_name + 1) == 0) continue;
+
+		char name[300];
+		snprintf(name, sizeof(name), "/%s", entry->d_name);
+		shm_unlink(name);
+	}
+
+	closedir(dir);
+}
+
+static INT32 cps3_rom_share_open()
+{
+	snprintf(cps3_rom_share_name, sizeof(cps3_rom_share_name), "/fba-cps3-%s-%08x-%x", BurnDrvGetTextA(DRV_NAME), cps3_rom_id(), nBurnVer);
+
+	UINT32 size = cps3_rom_cache_size();
+	INT32 fd;
+
+	while ((fd = shm_open(cps3_rom_share_name, O_RDWR, 0)) >= 0) {
+		INT32 ready = cps3_rom_share_ready(fd, size);
+
+		if (!ready) {
+			if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+				// still being loaded
+				close(fd);
+				usleep(50000);
+				continue;
+			}
+
+			// published since we looked, or left half done by an instance
+			// that went away (unless someone else got there first)
+			ready = cps3_rom_share_ready(fd, size);
+			if (!ready && cps3_rom_share_current(fd)) shm_unlink(cps3_rom_share_name);
+		}
+
+		if (ready) {
+			void * map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			close(fd);
+
+			if (map == MAP_FAILED) return 0;
+
+			cps3_rom_map = (UINT8 *)map;
+			cps3_rom_map_size = size;
+			cps3_rom_cached = 1;
+			return 1;
+		}
+
+		close(fd);
+	}
+
+	fd = shm_open(cps3_rom_share_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) return 0;
+
+	// an instance which opened it before we could lock it takes it over
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		close(fd);
+		return 0;
+	}
+
+	if (ftruncate(fd, size) == 0) {
+		void * map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+		if (map != MAP_FAILED) {
+			cps3_rom_map = (UINT8 *)map;
+			cps3_rom_map_size = size;
+			cps3_rom_share_fd = fd;
+			cps3_rom_share_reclaim();
+			return 0;
+		}
+	}
+
+	shm_unlink(cps3_rom_share_name);
+	close(fd);
+	return 0;
+}
+
+// the roms are loaded, let the others have them
+static void cps3_rom_share_publish()
+{
+	if (cps3_rom_share_fd < 0) return;
+
+	__sync_synchronize();
+	cps3_rom_cache_header_init((struct cps3_rom_cache_header *)cps3_rom_map);
+	__sync_synchronize();
+
+	// swap to a private mapping at the same address
+	if (mmap(cps3_rom_map, cps3_rom_map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, cps3_rom_share_fd, 0) == MAP_FAILED) {
+		bprintf(PRINT_ERROR, _T("Couldn't make the shared roms private\n"));
+	}
+
+	close(cps3_rom_share_fd);
+	cps3_rom_share_fd = -1;
+}
+
+#endif
+
+// called before the memory is allocated, so a mapped file can take the place of the roms
+static void cps3_rom_cache_open()
+{
+	cps3_rom_cached = 0;
+
+	// the user rom isn't kept as it is in low memory mode
+	if (cps3_user_compressed) return;
+
+#if defined CPS3_ROM_SHARE
+	if (cps3_rom_share && cps3_rom_share_open()) return;
+#endif
+
+	if (!cps3_rom_cache) return;
+
+	TCHAR szFilename[MAX_PATH];
+	if (cps3_cache_filename(szFilename, _T(".rom"))) return;
+
+	FILE * fp = _tfopen(szFilename, _T("rb"));
+	if (fp == NULL) return;
+
+	struct cps3_rom_cache_header want, header;
+	cps3_rom_cache_header_init(&want);
+
+	if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(&header, &want, sizeof(header))) {
+		bprintf(PRINT_NORMAL, _T("%s is out of date, the roms will be loaded again\n"), szFilename);
+		fclose(fp);
+		return;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	if ((UINT32)ftell(fp) != cps3_rom_cache_size()) {
+		fclose(fp);
+		return;
+	}
+
+#if defined (__linux__)
+	// (unless a new shared object needs filling)
+	if (cps3_rom_map == NULL) {
+		void * map = mmap(NULL, cps3_rom_cache_size(), PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+		fclose(fp);
+
+		if (map != MAP_FAILED) {
+			cps3_rom_map = (UINT8 *)map;
+			cps3_rom_map_size = cps3_rom_cache_size();
+			cps3_rom_cached = 1;
+		}
+		return;
+	}
+#endif
+
+	// read into place once the memory is allocated
+	cps3_rom_file = fp;
+	cps3_rom_cached = 1;
+}
+
+static void cps3_rom_cache_read()
+{
+	if (cps3_rom_file == NULL) return;
+
+	fseek(cps3_rom_file, CPS3_ROM_CACHE_HEADER, SEEK_SET);
+
+	if (fread(RomBios, 0x0080000, 1, cps3_rom_file) != 1 ||
+		(cps3_isSpecial && fread(RomGame, 0x1000000, 1, cps3_rom_file) != 1) ||
+		fread(RomGame_D, 0x1000000, 1, cps3_rom_file) != 1 ||
+		fread(RomUser, cps3_data_rom_size, 1, cps3_rom_file) != 1) {
+		cps3_rom_cached = 0;
+	}
+
+	fclose(cps3_rom_file);
+	cps3_rom_file = NULL;
+}
+
+static void cps3_rom_cache_save()
+{
+	if (!cps3_rom_cache || cps3_user_compressed) return;
+
+	TCHAR szFilename[MAX_PATH], szTemp[MAX_PATH + 4];
+	if (cps3_cache_filename(szFilename, _T(".rom"))) return;
+	_stprintf(szTemp, _T("%s.tmp"), szFilename);
+
+	FILE * fp = _tfopen(szTemp, _T("wb"));
+	if (fp == NULL) return;
+
+	UINT8 page[CPS3_ROM_CACHE_HEADER];
+	memset(page, 0, sizeof(page));
+	cps3_rom_cache_header_init((struct cps3_rom_cache_header *)page);
+
+	INT32 ok = fwrite(page, sizeof(page), 1, fp) == 1 &&
+		fwrite(RomBios, 0x0080000, 1, fp) == 1 &&
+		(!cps3_isSpecial || fwrite(RomGame, 0x1000000, 1, fp) == 1) &&
+		fwrite(RomGame_D, 0x1000000, 1, fp) == 1 &&
+		fwrite(RomUser, cps3_data_rom_size, 1, fp) == 1;
 
-			if(ctrl&0x80) {
-				UINT8 real_byte;
-				p &= 0x7f;
-				real_byte = px[ (chardma_table_address+p*2+0) ^ 0 ];
-				ds += ProcessByte8(real_byte,ds);
-				real_byte = px[ (chardma_table_address+p*2+1) ^ 0 ];
-				ds += ProcessByte8(real_byte,ds);
- 			} else {
- 				ds += ProcessByte8(p,ds);
- 			}
- 			++src;
- 			ctrl<<=1;
+	if (fclose(fp)) ok = 0;
 
-			if((ds-start)>=real_length)
-				return;
- 		}
+	// only replace the old file once the new one is complete
+	if (ok) {
+		remove(szFilename);
+		ok = (rename(szTemp, szFilename) == 0);
 	}
+
+	if (!ok) remove(szTemp);
 }
 
-static void cps3_process_character_dma(UINT32 address)
+static void cps3_rom_cache_exit()
 {
-	for (INT32 i=0; i<0x1000; i+=3) {
-		UINT32 dat1 = RamCRam[i+0+(address)];
-		UINT32 dat2 = RamCRam[i+1+(address)];
-		UINT32 dat3 = RamCRam[i+2+(address)];
-		UINT32 real_source      = (dat3<<1)-0x400000;
-		UINT32 real_destination =  dat2<<3;
-		UINT32 real_length      = (((dat1&0x001fffff)+1)<<3);
-		
-		if (dat1==0x01000000) break;	// end of list marker
-		if (dat1==0x13131313) break;	// our default fill
-		
-		switch ( dat1 & 0x00e00000 ) {
-		case 0x00800000:
-			chardma_table_address = real_source;
-			Sh2SetIRQLine(10, SH2_IRQSTATUS_AUTO);
-			break;
-		case 0x00400000:
-			cps3_do_char_dma( real_source, real_destination, real_length );
-			Sh2SetIRQLine(10, SH2_IRQSTATUS_AUTO);
-			break;
-		case 0x00600000:
-			//bprintf(PRINT_NORMAL, _T("Character DMA (alt) start %08x to %08x with %d\n"), real_source, real_destination, real_length);
-			/* 8bpp DMA decompression
-			   - this is used on SFIII NG Sean's Stage ONLY */
-			cps3_do_alt_char_dma( real_source, real_destination, real_length );
-			Sh2SetIRQLine(10, SH2_IRQSTATUS_AUTO);
-			break;
-		case 0x00000000:
-			// Red Earth need this. 8192 byte trans to 0x00003000 (from 0x007ec000???)
-			// seems some stars(6bit alpha) without compress
-			//bprintf(PRINT_NORMAL, _T("Character DMA (redearth) start %08x to %08x with %d\n"), real_source, real_destination, real_length);
-			memcpy( (UINT8 *)RamCRam + real_destination, RomUser + real_source, real_length );
-			Sh2SetIRQLine(10, SH2_IRQSTATUS_AUTO);
-			break;
-		default:
-			bprintf(PRINT_NORMAL, _T("Character DMA Unknown DMA List Command Type %08x\n"), dat1);
-		}
+#if defined CPS3_ROM_SHARE
+	// never finished loading, don't leave the others waiting for it
+	// (removed before the lock goes, so a waiter can't have replaced it yet)
+	if (cps3_rom_share_fd >= 0) {
+		shm_unlink(cps3_rom_share_name);
+		close(cps3_rom_share_fd);
+		cps3_rom_share_fd = -1;
+	}
+#endif
+
+	if (cps3_rom_map) {
+#if defined (__linux__)
+		munmap(cps3_rom_map, cps3_rom_map_size);
+#endif
+		cps3_rom_map = NULL;
+		cps3_rom_map_size = 0;
+	}
+
+	if (cps3_rom_file) {
+		fclose(cps3_rom_file);
+		cps3_rom_file = NULL;
 	}
+
+	cps3_rom_cached = 0;
 }
 
+#endif
+
 static INT32 MemIndex()
 {
 	UINT8 *Next; Next = Mem;
-	RomBios 	= Next; Next += 0x0080000;
 #ifndef WII_VM
-	RomUser		= Next; Next += cps3_data_rom_size;	// 0x5000000;
+	if (cps3_rom_map) {
+		// the roms live in the mapped cache file
+		RomBios		= cps3_rom_map + CPS3_ROM_CACHE_HEADER;
+		RomGame		= RomBios + 0x0080000;
+		RomGame_D	= RomGame + (cps3_isSpecial ? 0x1000000 : 0);
+		RomUser		= RomGame_D + 0x1000000;
+	} else {
+		RomBios		= Next; Next += 0x0080000;
+		RomUser		= NULL;
+		if (!cps3_user_compressed) {
+			RomUser	= Next; Next += cps3_data_rom_size;	// 0x5000000;
+		}
+	}
+#else
+	RomBios 	= Next; Next += 0x0080000;
 #endif
 	RamStart	= Next;
 	
-	RomGame 	= Next; Next += 0x1000000;
-	RomGame_D 	= Next; Next += 0x1000000;
+#ifndef WII_VM
+	if (cps3_rom_map == NULL)
+#endif
+	{
+		RomGame 	= Next; Next += 0x1000000;
+		RomGame_D	= RomGame;
+		if (cps3_isSpecial) {
+			RomGame_D = Next; Next += 0x1000000;
+		}
+	}
 	
 	RamC000		= Next; Next += 0x0000400;
 	RamC000_D	= Next; Next += 0x0000400;
@@ -505,12 +1901,286 @@ static INT32 MemIndex()
 	RamEnd		= Next;
 	
 	Cps3CurPal		= (UINT16 *) Next; Next += 0x020001 * sizeof(UINT16); // iq_132 - layer disable
+	Cps3PalLut	= (UINT16 *) Next; Next += 0x0008000 * sizeof(UINT16);
 	RamScreen	= (UINT32 *) Next; Next += (512 * 2) * (224 * 2 + 32) * sizeof(UINT32);
+
+	RamSprLast	= (UINT32 *) Next; Next += 0x0020000 * sizeof(UINT32);
+	RamSSLast	= (UINT32 *) Next; Next += 0x0004000 * sizeof(UINT32);
+
+	Cps3Glyphs	= (cps3_glyph *) Next; Next += CPS3_GLYPH_SLOTS * sizeof(cps3_glyph);
 	
 	MemEnd		= Next;
 	return 0;
 }
 
+// Palette conversion
+
+static void cps3_pal_lut_build()
+{
+	cps3_pal_rgb565 = 1;
+
+	for (INT32 i = 0; i < 0x8000; i++) {
+		INT32 r = (i & 0x001F) << 3;	// Red
+		INT32 g = (i & 0x03E0) >> 2;	// Green
+		INT32 b = (i & 0x7C00) >> 7;	// Blue
+		r |= r >> 5;
+		g |= g >> 5;
+		b |= b >> 5;
+		Cps3PalLut[i] = BurnHighCol(r, g, b, 0);
+
+		if (Cps3PalLut[i] != (((i & 0x001f) << 11) | ((i & 0x03e0) << 1) | ((i & 0x0200) >> 4) | ((i & 0x7c00) >> 10)))
+			cps3_pal_rgb565 = 0;
+
+		// palette dma doesn't expand the low bits
+		if ((UINT16)BurnHighCol((i & 0x001f) << 3, (i & 0x03e0) >> 2, (i & 0x7c00) >> 7, 0) != (((i & 0x001f) << 11) | ((i & 0x03e0) << 1) | ((i & 0x7c00) >> 10)))
+			cps3_pal_rgb565 = 0;
+	}
+}
+
+static inline void cps3_pal_dirty(UINT32 index, UINT32 count)
+{
+	if (cps3_pal_dirty_end <= cps3_pal_dirty_start) {
+		cps3_pal_dirty_start = index;
+		cps3_pal_dirty_end = index + count;
+	} else {
+		if (index < cps3_pal_dirty_start) cps3_pal_dirty_start = index;
+		if (index + count > cps3_pal_dirty_end) cps3_pal_dirty_end = index + count;
+	}
+}
+
+static inline UINT16 cps3_pal_entry(UINT32 index)
+{
+#ifdef MSB_FIRST
+	return RamPal[index];
+#else
+	return RamPal[index ^ 1];
+#endif
+}
+
+// convert the dirty range of RamPal into Cps3CurPal
+static void cps3_pal_flush()
+{
+	UINT32 i = cps3_pal_dirty_start;
+	UINT32 end = (cps3_pal_dirty_end > 0x20000) ? 0x20000 : cps3_pal_dirty_end;
+
+	cps3_pal_dirty_start = cps3_pal_dirty_end = 0;
+	if (i >= end) return;
+
+	cps3_pal_written(i, end - i);
+
+#if defined CPS3_SSE2 || defined CPS3_NEON
+	if (cps3_pal_rgb565) {
+		for (; i < end && (i & 7); i++)
+			Cps3CurPal[i] = Cps3PalLut[cps3_pal_entry(i) & 0x7fff];
+
+		for (; i + 8 <= end; i += 8) {
+#if defined CPS3_SSE2
+			__m128i d = _mm_loadu_si128((__m128i *)(RamPal + i));
+#ifndef MSB_FIRST
+			d = _mm_shufflehi_epi16(_mm_shufflelo_epi16(d, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+#endif
+			__m128i c = _mm_or_si128(_mm_slli_epi16(d, 11), _mm_and_si128(_mm_srli_epi16(d, 10), _mm_set1_epi16(0x001f)));
+			c = _mm_or_si128(c, _mm_and_si128(_mm_slli_epi16(d, 1), _mm_set1_epi16(0x07c0)));
+			c = _mm_or_si128(c, _mm_and_si128(_mm_srli_epi16(d, 4), _mm_set1_epi16(0x0020)));
+			_mm_storeu_si128((__m128i *)(Cps3CurPal + i), c);
+#else
+			uint16x8_t d = vld1q_u16(RamPal + i);
+#ifndef MSB_FIRST
+			d = vrev32q_u16(d);
+#endif
+			uint16x8_t c = vorrq_u16(vshlq_n_u16(d, 11), vandq_u16(vshrq_n_u16(d, 10), vdupq_n_u16(0x001f)));
+			c = vorrq_u16(c, vandq_u16(vshlq_n_u16(d, 1), vdupq_n_u16(0x07c0)));
+			c = vorrq_u16(c, vandq_u16(vshrq_n_u16(d, 4), vdupq_n_u16(0x0020)));
+			vst1q_u16(Cps3CurPal + i, c);
+#endif
+		}
+	}
+#endif
+
+	for (; i < end; i++)
+		Cps3CurPal[i] = Cps3PalLut[cps3_pal_entry(i) & 0x7fff];
+}
+
+static inline void cps3_pal_dma_entry(UINT16 * src, UINT32 i)
+{
+	UINT16 coldata = src[i];
+
+#ifndef MSB_FIRST
+	coldata = (coldata << 8) | (coldata >> 8);
+#endif
+
+	UINT32 r = (coldata & 0x001F) >>  0;
+	UINT32 g = (coldata & 0x03E0) >>  5;
+	UINT32 b = (coldata & 0x7C00) >> 10;
+	if (paldma_fade!=0) {
+		INT32 fade;
+		fade = (paldma_fade & 0x3f000000)>>24; r = (r*fade)>>5; if (r>0x1f) r = 0x1f;
+		fade = (paldma_fade & 0x003f0000)>>16; g = (g*fade)>>5; if (g>0x1f) g = 0x1f;
+		fade = (paldma_fade & 0x0000003f)>> 0; b = (b*fade)>>5; if (b>0x1f) b = 0x1f;
+		coldata = (r << 0) | (g << 5) | (b << 10);
+	}
+
+	r = r << 3;
+	g = g << 3;
+	b = b << 3;
+
+#ifdef MSB_FIRST
+	RamPal[(paldma_dest + i)] = coldata;
+#else
+	RamPal[(paldma_dest + i) ^ 1] = coldata;
+#endif
+	Cps3CurPal[(paldma_dest + i) ] = BurnHighCol(r, g, b, 0);
+}
+
+// copy paldma_length colours from the user rom to the palette, applying the fade
+static void cps3_pal_dma()
+{
+	UINT8 * data = cps3_user_data((paldma_source - 0x200000) * 2, paldma_length * 2, 0);
+	if (data == NULL) return;
+
+	UINT16 * src = (UINT16 *)data + (paldma_source - 0x200000);
+	UINT32 i = 0;
+
+#if defined CPS3_SSE2 || defined CPS3_NEON
+	if (cps3_pal_rgb565) {
+		for (; i < paldma_length && ((paldma_dest + i) & 7); i++)
+			cps3_pal_dma_entry(src, i);
+
+#if defined CPS3_SSE2
+		const __m128i mask = _mm_set1_epi16(0x001f);
+		const __m128i fr = _mm_set1_epi16((paldma_fade & 0x3f000000) >> 24);
+		const __m128i fg = _mm_set1_epi16((paldma_fade & 0x003f0000) >> 16);
+		const __m128i fb = _mm_set1_epi16((paldma_fade & 0x0000003f) >>  0);
+
+		for (; i + 8 <= paldma_length; i += 8) {
+			__m128i c = _mm_loadu_si128((__m128i *)(src + i));
+#ifndef MSB_FIRST
+			c = _mm_or_si128(_mm_slli_epi16(c, 8), _mm_srli_epi16(c, 8));
+#endif
+			__m128i r = _mm_and_si128(c, mask);
+			__m128i g = _mm_and_si128(_mm_srli_epi16(c, 5), mask);
+			__m128i b = _mm_and_si128(_mm_srli_epi16(c, 10), mask);
+
+			if (paldma_fade) {
+				r = _mm_min_epi16(_mm_srli_epi16(_mm_mullo_epi16(r, fr), 5), mask);
+				g = _mm_min_epi16(_mm_srli_epi16(_mm_mullo_epi16(g, fg), 5), mask);
+				b = _mm_min_epi16(_mm_srli_epi16(_mm_mullo_epi16(b, fb), 5), mask);
+				c = _mm_or_si128(r, _mm_or_si128(_mm_slli_epi16(g, 5), _mm_slli_epi16(b, 10)));
+			}
+
+#ifndef MSB_FIRST
+			c = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+#endif
+			_mm_storeu_si128((__m128i *)(RamPal + paldma_dest + i), c);
+			_mm_storeu_si128((__m128i *)(Cps3CurPal + paldma_dest + i), _mm_or_si128(_mm_slli_epi16(r, 11), _mm_or_si128(_mm_slli_epi16(g, 6), b)));
+		}
+#else
+		const uint16x8_t mask = vdupq_n_u16(0x001f);
+		const uint16x8_t fr = vdupq_n_u16((paldma_fade & 0x3f000000) >> 24);
+		const uint16x8_t fg = vdupq_n_u16((paldma_fade & 0x003f0000) >> 16);
+		const uint16x8_t fb = vdupq_n_u16((paldma_fade & 0x0000003f) >>  0);
+
+		for (; i + 8 <= paldma_length; i += 8) {
+			uint16x8_t c = vld1q_u16(src + i);
+#ifndef MSB_FIRST
+			c = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(c)));
+#endif
+			uint16x8_t r = vandq_u16(c, mask);
+			uint16x8_t g = vandq_u16(vshrq_n_u16(c, 5), mask);
+			uint16x8_t b = vandq_u16(vshrq_n_u16(c, 10), mask);
+
+			if (paldma_fade) {
+				r = vminq_u16(vshrq_n_u16(vmulq_u16(r, fr), 5), mask);
+				g = vminq_u16(vshrq_n_u16(vmulq_u16(g, fg), 5), mask);
+				b = vminq_u16(vshrq_n_u16(vmulq_u16(b, fb), 5), mask);
+				c = vorrq_u16(r, vorrq_u16(vshlq_n_u16(g, 5), vshlq_n_u16(b, 10)));
+			}
+
+#ifndef MSB_FIRST
+			c = vrev32q_u16(c);
+#endif
+			vst1q_u16(RamPal + paldma_dest + i, c);
+			vst1q_u16(Cps3CurPal + paldma_dest + i, vorrq_u16(vshlq_n_u16(r, 11), vorrq_u16(vshlq_n_u16(g, 6), b)));
+		}
+#endif
+	}
+#endif
+
+	for (; i < paldma_length; i++)
+		cps3_pal_dma_entry(src, i);
+
+	if (paldma_length) cps3_pal_written(paldma_dest, paldma_length);
+}
+
+// Character RAM window, reads go straight to memory unless a character DMA
+// is still running
+static void cps3_map_cram()
+{
+	Sh2MapMemory(((UINT8 *)RamCRam) + (cram_bank << 20), 0x04100000, 0x041fffff, SH2_READ | SH2_FETCH);
+	Sh2MapHandler(6, 0x04100000, 0x041fffff, cps3_chardma_pending ? (SH2_READ | SH2_WRITE) : SH2_WRITE);
+}
+
+UINT8 __fastcall cps3CRamReadByte(UINT32 addr)
+{
+	addr = (cram_bank << 20) | (addr & 0xfffff);
+	cps3_chardma_wait(addr, 1);
+#ifdef MSB_FIRST
+	return *((UINT8 *)RamCRam + addr);
+#else
+	return *((UINT8 *)RamCRam + (addr ^ 0x03));
+#endif
+}
+
+UINT16 __fastcall cps3CRamReadWord(UINT32 addr)
+{
+	addr = (cram_bank << 20) | (addr & 0xffffe);
+	cps3_chardma_wait(addr, 2);
+#ifdef MSB_FIRST
+	return *(UINT16 *)((UINT8 *)RamCRam + addr);
+#else
+	return *(UINT16 *)((UINT8 *)RamCRam + (addr ^ 0x02));
+#endif
+}
+
+UINT32 __fastcall cps3CRamReadLong(UINT32 addr)
+{
+	addr = (cram_bank << 20) | (addr & 0xffffc);
+	cps3_chardma_wait(addr, 4);
+	return *(UINT32 *)((UINT8 *)RamCRam + addr);
+}
+
+void __fastcall cps3CRamWriteByte(UINT32 addr, UINT8 data)
+{
+	addr = (cram_bank << 20) | (addr & 0xfffff);
+	cps3_chardma_wait(addr, 1);
+#ifdef MSB_FIRST
+	*((UINT8 *)RamCRam + addr) = data;
+#else
+	*((UINT8 *)RamCRam + (addr ^ 0x03)) = data;
+#endif
+	cps3_cram_written(addr, 1);
+}
+
+void __fastcall cps3CRamWriteWord(UINT32 addr, UINT16 data)
+{
+	addr = (cram_bank << 20) | (addr & 0xffffe);
+	cps3_chardma_wait(addr, 2);
+#ifdef MSB_FIRST
+	*(UINT16 *)((UINT8 *)RamCRam + addr) = data;
+#else
+	*(UINT16 *)((UINT8 *)RamCRam + (addr ^ 0x02)) = data;
+#endif
+	cps3_cram_written(addr, 1);
+}
+
+void __fastcall cps3CRamWriteLong(UINT32 addr, UINT32 data)
+{
+	addr = (cram_bank << 20) | (addr & 0xffffc);
+	cps3_chardma_wait(addr, 4);
+	*(UINT32 *)((UINT8 *)RamCRam + addr) = data;
+	cps3_cram_written(addr, 1);
+}
+
 UINT8 __fastcall cps3ReadByte(UINT32 addr)
 {
 	addr &= 0xc7ffffff;
@@ -638,7 +2308,7 @@ void __fastcall cps3WriteWord(UINT32 addr, UINT16 data)
 		if (cram_bank != data) {
 			cram_bank = data & 7;
 			//bprintf(PRINT_NORMAL, _T("CRAM bank set to %d\n"), data);
-			Sh2MapMemory(((UINT8 *)RamCRam) + (cram_bank << 20), 0x04100000, 0x041fffff, SH2_RAM);
+			cps3_map_cram();
 		}
 		break;
 
@@ -670,36 +2340,7 @@ void __fastcall cps3WriteWord(UINT32 addr, UINT16 data)
 	case 0x040c00ae:
 		//bprintf(PRINT_NORMAL, _T("palettedma [%04x]  from %08x to %08x fade %08x size %d\n"), data, (paldma_source << 1), paldma_dest, paldma_fade, paldma_length);
 		if (data & 0x0002) {
-			for (UINT32 i=0; i<paldma_length; i++) {
-				UINT16 * src = (UINT16 *)RomUser;
-				UINT16 coldata = src[(paldma_source - 0x200000 + i)];
-				
-#ifndef MSB_FIRST
-				coldata = (coldata << 8) | (coldata >> 8);
-#endif
-
-				UINT32 r = (coldata & 0x001F) >>  0;
-				UINT32 g = (coldata & 0x03E0) >>  5;
-				UINT32 b = (coldata & 0x7C00) >> 10;
-				if (paldma_fade!=0) {
-					INT32 fade;
-					fade = (paldma_fade & 0x3f000000)>>24; r = (r*fade)>>5; if (r>0x1f) r = 0x1f;
-					fade = (paldma_fade & 0x003f0000)>>16; g = (g*fade)>>5; if (g>0x1f) g = 0x1f;
-					fade = (paldma_fade & 0x0000003f)>> 0; b = (b*fade)>>5; if (b>0x1f) b = 0x1f;
-					coldata = (r << 0) | (g << 5) | (b << 10);
-				}
-				
-				r = r << 3;
-				g = g << 3;
-				b = b << 3;
-
-#ifdef MSB_FIRST
-				RamPal[(paldma_dest + i)] = coldata;
-#else
-				RamPal[(paldma_dest + i) ^ 1] = coldata;
-#endif
-				Cps3CurPal[(paldma_dest + i) ] = BurnHighCol(r, g, b, 0);
-			}
+			cps3_pal_dma();
 			Sh2SetIRQLine(10, SH2_IRQSTATUS_AUTO);
 		}
 		break;
@@ -840,8 +2481,9 @@ UINT32 __fastcall cps3RomReadLong(UINT32 addr)
 	
 	UINT32 pc = Sh2GetPC(0);
 	if (pc == cps3_bios_test_hack || pc == cps3_game_test_hack){
+		// the encrypted value, there's no copy of it kept
 		if ( main_flash.flash_mode == FM_NORMAL )
-			retvalue = *(UINT32 *)(RomGame + (addr & 0x00ffffff));
+			retvalue = *(UINT32 *)(RomGame_D + (addr & 0x00ffffff)) ^ cps3_mask((addr & 0x00ffffff) + 0x06000000, cps3_key1, cps3_key2);
 		bprintf(2, _T("CPS3 Hack : read long from %08x [%08x]\n"), addr, retvalue );
 	}
 	return retvalue;
@@ -869,7 +2511,7 @@ void __fastcall cps3RomWriteLong(UINT32 addr, UINT32 data)
 		
 		if ( main_flash.flash_mode == FM_NORMAL ) {
 			bprintf(1, _T("Rom Attempt to write long value %8x to location %8x\n"), data, addr);
-			*(UINT32 *)(RomGame + addr) = data;
+			if (cps3_isSpecial) *(UINT32 *)(RomGame + addr) = data;
 			*(UINT32 *)(RomGame_D + addr) = data ^ cps3_mask(addr + 0x06000000, cps3_key1, cps3_key2);
 		}
 	}
@@ -947,15 +2589,8 @@ void __fastcall cps3VidWriteWord(UINT32 addr, UINT16 data)
 		RamPal[palindex ^ 1] = data;
 #endif
 
-		INT32 r = (data & 0x001F) << 3;	// Red
-		INT32 g = (data & 0x03E0) >> 2;	// Green
-		INT32 b = (data & 0x7C00) >> 7;	// Blue
-		
-		r |= r >> 5;
-		g |= g >> 5;
-		b |= b >> 5;
-			
-		Cps3CurPal[palindex] = BurnHighCol(r, g, b, 0);
+		Cps3CurPal[palindex] = Cps3PalLut[data & 0x7fff];
+		cps3_pal_written(palindex, 1);
 	
 	} else
 	bprintf(PRINT_NORMAL, _T("Video Attempt to write word value %4x to location %8x\n"), data, addr);
@@ -1041,9 +2676,11 @@ static void Cps3PatchRegion()
 
 static INT32 Cps3Reset()
 {
+	cps3_chardma_sync();
+
 	// re-map cram_bank
 	cram_bank = 0;
-	Sh2MapMemory((UINT8 *)RamCRam, 0x04100000, 0x041fffff, SH2_RAM);
+	cps3_map_cram();
 
 	Cps3PatchRegion();
 	
@@ -1073,18 +2710,56 @@ static INT32 Cps3Reset()
 	cps3_current_eeprom_read = 0;	
 	cps3SndReset();	
 	cps3_reset = 0;	
+	cps3_redraw = 1;
 	return 0;
 }
 
-static void be_to_le(UINT8 * p, INT32 size)
+// The program roms are in groups of four and the user roms in pairs, each
+// interleaved a byte at a time. The groups are queued up and then loaded
+// side by side, except on the Wii where they're loaded one at a time to
+// keep the progress bar going.
+
+#define CPS3_LOAD_GROUPS	64
+
+static struct BurnRomGroup cps3_load_groups[CPS3_LOAD_GROUPS];
+static INT32 cps3_load_group_count = 0;
+static INT32 cps3_load_prg_count = 0;		// the first groups, which have to load
+
+static INT32 cps3_load_group(UINT8 * dest, INT32 rom, INT32 count)
 {
-	UINT8 c;
-	for(INT32 i=0; i<size; i+=4, p+=4) {
-		c = *(p+0);	*(p+0) = *(p+3);	*(p+3) = c;
-		c = *(p+1);	*(p+1) = *(p+2);	*(p+2) = c;
-	}
+#ifdef WII_VM
+	return BurnLoadRomGroup(dest, rom, count);
+#else
+	if (cps3_load_group_count == CPS3_LOAD_GROUPS) return BurnLoadRomGroup(dest, rom, count);
+
+	struct BurnRomGroup * g = &cps3_load_groups[cps3_load_group_count++];
+	g->Dest = dest;
+	g->i = rom;
+	g->nRoms = count;
+	g->nRet = 0;
+	if (count == 4) cps3_load_prg_count = cps3_load_group_count;
+
+	return 0;
+#endif
 }
 
+static INT32 cps3_load_queued()
+{
+	INT32 count = cps3_load_group_count;
+	INT32 prg = cps3_load_prg_count;
+
+	cps3_load_group_count = 0;
+	cps3_load_prg_count = 0;
+
+	BurnLoadRomGroups(cps3_load_groups, count);
+
+	// the user roms never had their result checked
+	for (INT32 i = 0; i < prg; i++) {
+		if (cps3_load_groups[i].nRet) return 1;
+	}
+
+	return 0;
+}
 
 INT32 cps3Init()
 {
@@ -1103,29 +2778,59 @@ INT32 cps3Init()
 	
 	// CHD games 
 	if (cps3_data_rom_size == 0) cps3_data_rom_size = 0x5000000;	
+
+#ifdef WII_VM
+	cps3_user_compressed = 0;
+#else
+	cps3_user_compressed = cps3_user_compress;
+	cps3_rom_cache_open();
+#endif
 	
+	BurnPhaseBegin("memory");
 	Mem = NULL;
 	MemIndex();
 	INT32 nLen = MemEnd - (UINT8 *)0;
-	if ((Mem = (UINT8 *)BurnMalloc(nLen)) == NULL) return 1;
+	if ((Mem = (UINT8 *)BurnMalloc(nLen)) == NULL) {
+		BurnPhaseEnd();
+		return 1;
+	}
 	memset(Mem, 0, nLen);										// blank all memory
 	MemIndex();	
-	
-	// load and decode bios roms
-	ii = 0; offset = 0;
-	while (BurnDrvGetRomInfo(&pri, ii) == 0) {
-		if (pri.nType & BRF_BIOS) {
-			nRet = BurnLoadRom(RomBios + offset, ii, 1); 
-			if (nRet != 0) return 1;
-			offset += pri.nLen;
+
+	cps3_pal_lut_build();
+	BurnPhaseEnd();
+
+	if (cps3_user_compressed && cps3_user_init()) return 1;
+
+#ifndef WII_VM
+	BurnPhaseBegin("rom cache read");
+	cps3_rom_cache_read();
+	BurnPhaseEnd();
+
+	if (!cps3_rom_cached)
+#endif
+	{
+		// load and decode bios roms
+		BurnPhaseBegin("bios");
+		ii = 0; offset = 0;
+		while (BurnDrvGetRomInfo(&pri, ii) == 0) {
+			if (pri.nType & BRF_BIOS) {
+				nRet = BurnLoadRom(RomBios + offset, ii, 1); 
+				if (nRet != 0) {
+					BurnPhaseEnd();
+					return 1;
+				}
+				offset += pri.nLen;
+			}
+			ii++;
 		}
-		ii++;
-	}
 
 #ifndef MSB_FIRST
-	be_to_le( RomBios, 0x080000 );
+		BurnByteswap32( RomBios, 0x080000 );
 #endif
-	cps3_decrypt_bios();
+		cps3_decrypt_bios();
+		BurnPhaseEnd();
+	}
 
 #ifdef WII_VM
 	UINT32 CacheRead = 0;
@@ -1134,20 +2839,24 @@ INT32 cps3Init()
 struct CacheInfo Cache[] = {
 		{"RomUser", RomUser, (cps3_data_rom_size) / (1*MB) },
 		{"RomGame", RomGame, (16*MB) / (1*MB) },
-		{"RomGame_D", RomGame_D, (16*MB) / (1*MB) }
+		{"RomGame_D", RomGame_D, cps3_isSpecial ? (16*MB) / (1*MB) : 0 }	// decrypted in place otherwise
 };
 
 if(BurnCreateCache)
+#else
+if(!cps3_rom_cached)
 #endif
 {
-	// load and decode sh-2 program roms
+	// load sh-2 program roms
+	BurnPhaseBegin("load roms");
 	ii = 0;	offset = 0;
 	while (BurnDrvGetRomInfo(&pri, ii) == 0) {
 		if (pri.nType & BRF_PRG) {
-			nRet = BurnLoadRom(RomGame + offset + 0, ii + 0, 4); if (nRet != 0) return 1;
-			nRet = BurnLoadRom(RomGame + offset + 1, ii + 1, 4); if (nRet != 0) return 1;
-			nRet = BurnLoadRom(RomGame + offset + 2, ii + 2, 4); if (nRet != 0) return 1;
-			nRet = BurnLoadRom(RomGame + offset + 3, ii + 3, 4); if (nRet != 0) return 1;
+			nRet = cps3_load_group(RomGame + offset, ii, 4);
+			if (nRet != 0) {
+				BurnPhaseEnd();
+				return 1;
+			}
 			offset += pri.nLen * 4;
 			ii += 4;
 		} else {
@@ -1155,10 +2864,6 @@ if(BurnCreateCache)
 		}
 	}
 	
-#ifndef MSB_FIRST
-	be_to_le( RomGame, 0x1000000 );
-#endif
-	cps3_decrypt_game();
 #ifdef WII_VM
 	INT32 PRG_size = offset;
 	UINT8 step = (cps3_data_rom_size)/(1*MB);
@@ -1169,8 +2874,20 @@ if(BurnCreateCache)
 	ii = 0;	offset = 0;
 	while (BurnDrvGetRomInfo(&pri, ii) == 0) {
 		if (pri.nType & (BRF_GRA | BRF_SND)) {
-			BurnLoadRom(RomUser + offset + 0, ii + 0, 2);
-			BurnLoadRom(RomUser + offset + 1, ii + 1, 2);
+			if (cps3_user_compressed) {
+				// one pair at a time, so the whole user rom is never unpacked
+				// (zeroed like Mem, in case a rom is missing)
+				UINT8 * pair = (UINT8 *)calloc(pri.nLen, 2);
+				if (pair == NULL) {
+					BurnPhaseEnd();
+					return 1;
+				}
+				BurnLoadRomGroup(pair, ii, 2);
+				cps3_user_store(pair, pri.nLen * 2);
+				free(pair);
+			} else {
+				cps3_load_group(RomUser + offset, ii, 2);
+			}
 			offset += pri.nLen * 2;
 			ii += 2;
 #ifdef WII_VM
@@ -1183,15 +2900,41 @@ if(BurnCreateCache)
 			ii++;
 		}
 	}
+
+	if (cps3_load_queued()) {
+		BurnPhaseEnd();
+		return 1;
+	}
+	BurnPhaseEnd();
+
+#ifndef MSB_FIRST
+	BurnPhaseBegin("byteswap");
+	BurnByteswap32( RomGame, 0x1000000 );
+	BurnPhaseEnd();
+#endif
+	BurnPhaseBegin("decrypt");
+	cps3_decrypt_game();
+	BurnPhaseEnd();
 }
 #ifdef WII_VM
 else // Load the cache files
 {
 	CacheHandle(Cache, CacheRead, "", READ);
 }
+#else
+	if (cps3_user_compressed && cps3_user_finish()) return 1;
+	if (!cps3_rom_cached) {
+		BurnPhaseBegin("rom cache save");
+		cps3_rom_cache_save();
+		BurnPhaseEnd();
+	}
+#if defined CPS3_ROM_SHARE
+	cps3_rom_share_publish();
+#endif
 #endif
 
 	{
+		BurnPhaseBegin("sh2 init");
 		Sh2Init(1);
 		Sh2Open(0);
 
@@ -1265,6 +3008,13 @@ else // Load the cache files
 		Sh2SetWriteWordHandler(4, cps3VidWriteWord);
 		Sh2SetWriteLongHandler(4, cps3VidWriteLong);
 
+		Sh2SetReadByteHandler (6, cps3CRamReadByte);
+		Sh2SetReadWordHandler (6, cps3CRamReadWord);
+		Sh2SetReadLongHandler (6, cps3CRamReadLong);
+		Sh2SetWriteByteHandler(6, cps3CRamWriteByte);
+		Sh2SetWriteWordHandler(6, cps3CRamWriteWord);
+		Sh2SetWriteLongHandler(6, cps3CRamWriteLong);
+
 #ifdef SPEED_HACK
 		// install speedup read handler
 		Sh2MapHandler(5,			0x02000000 | (cps3_speedup_ram_address & 0x030000),
@@ -1274,6 +3024,7 @@ else // Load the cache files
 		Sh2SetReadLongHandler (5, cps3RamReadLong);
 #endif
 
+		BurnPhaseEnd();
 	}
 	
 	BurnDrvGetVisibleSize(&cps3_gfx_width, &cps3_gfx_height);	
@@ -1283,6 +3034,10 @@ else // Load the cache files
 	cps3SndSetRoute(BURN_SND_CPS3SND_ROUTE_2, 1.00, BURN_SND_ROUTE_RIGHT);
 	
 	pBurnDrvPalette = (UINT32*)Cps3CurPal;
+
+	// character DMA is done in the background when there's a spare core
+	if (BurnThreadCount() > 1 && !cps3_user_compressed) cps3_chardma_worker = BurnWorkerCreate();
+	cps3_chardma_cache_load();
 		
 #ifdef WII_VM
 	if(BurnCreateCache)
@@ -1296,6 +3051,10 @@ else // Load the cache files
 
 INT32 cps3Exit()
 {
+	cps3_chardma_sync();
+	BurnWorkerDestroy(cps3_chardma_worker);
+	cps3_chardma_worker = NULL;
+
 	Sh2Exit();
 #ifdef WII_VM
 	RomUser = NULL;
@@ -1304,123 +3063,19 @@ INT32 cps3Exit()
 #endif
 	BurnFree(Mem);
 
+	cps3_chardma_cache_exit();
+	cps3_user_exit();
+
 	cps3SndExit();
 
+#ifndef WII_VM
+	cps3_rom_cache_exit();
+#endif
+
 	return 0;
 }
 
 
-static void cps3_drawgfxzoom_0(UINT32 code, UINT32 pal, INT32 flipx, INT32 flipy, INT32 x, INT32 y)
-{
-	if ((x > (cps3_gfx_width - 8)) || (y > (cps3_gfx_height - 8))) return;
-	UINT16 * dst = (UINT16 *) pBurnDraw;
-	UINT8 * src = (UINT8 *)RamSS;
-	UINT16 * color = Cps3CurPal + (pal << 4);
-	dst += (y * cps3_gfx_width + x);
-	src += code * 64;
-	
-	if ( flipy ) {
-		dst += cps3_gfx_width * 7;
-
-#ifdef MSB_FIRST
-		if ( flipx )
-			for(int i=0; i<8; i++, dst-= cps3_gfx_width, src += 8) {
-				if ( src[ 1] & 0xf ) dst[7] = color [ src[ 1] & 0xf ];
-				if ( src[ 1] >>  4 ) dst[6] = color [ src[ 1] >>  4 ];
-				if ( src[ 3] & 0xf ) dst[5] = color [ src[ 3] & 0xf ];
-				if ( src[ 3] >>  4 ) dst[4] = color [ src[ 3] >>  4 ];
-				if ( src[ 5] & 0xf ) dst[3] = color [ src[ 5] & 0xf ];
-				if ( src[ 5] >>  4 ) dst[2] = color [ src[ 5] >>  4 ];
-				if ( src[ 7] & 0xf ) dst[1] = color [ src[ 7] & 0xf ];
-				if ( src[ 7] >>  4 ) dst[0] = color [ src[ 7] >>  4 ];
-			}
-		else
-			for(int i=0; i<8; i++, dst-= cps3_gfx_width, src += 8) {
-				if ( src[ 1] & 0xf ) dst[0] = color [ src[ 1] & 0xf ];
-				if ( src[ 1] >>  4 ) dst[1] = color [ src[ 1] >>  4 ];
-				if ( src[ 3] & 0xf ) dst[2] = color [ src[ 3] & 0xf ];
-				if ( src[ 3] >>  4 ) dst[3] = color [ src[ 3] >>  4 ];
-				if ( src[ 5] & 0xf ) dst[4] = color [ src[ 5] & 0xf ];
-				if ( src[ 5] >>  4 ) dst[5] = color [ src[ 5] >>  4 ];
-				if ( src[ 7] & 0xf ) dst[6] = color [ src[ 7] & 0xf ];
-				if ( src[ 7] >>  4 ) dst[7] = color [ src[ 7] >>  4 ];
-			}
-
-	} else {
-		if ( flipx )
-			for(int i=0; i<8; i++, dst+= cps3_gfx_width, src += 8) {
-				if ( src[ 1] & 0xf ) dst[7] = color [ src[ 1] & 0xf ];
-				if ( src[ 1] >>  4 ) dst[6] = color [ src[ 1] >>  4 ];
-				if ( src[ 3] & 0xf ) dst[5] = color [ src[ 3] & 0xf ];
-				if ( src[ 3] >>  4 ) dst[4] = color [ src[ 3] >>  4 ];
-				if ( src[ 5] & 0xf ) dst[3] = color [ src[ 5] & 0xf ];
-				if ( src[ 5] >>  4 ) dst[2] = color [ src[ 5] >>  4 ];
-				if ( src[ 7] & 0xf ) dst[1] = color [ src[ 7] & 0xf ];
-				if ( src[ 7] >>  4 ) dst[0] = color [ src[ 7] >>  4 ];
-			}
-		else
-			for(int i=0; i<8; i++, dst+= cps3_gfx_width, src += 8) {
-				if ( src[ 1 ] & 0xf ) dst[0] = color [ src[ 1 ] & 0xf ];
-				if ( src[ 1 ] >>  4 ) dst[1] = color [ src[ 1 ] >>  4 ];
-				if ( src[ 3 ] & 0xf ) dst[2] = color [ src[ 3 ] & 0xf ];
-				if ( src[ 3 ] >>  4 ) dst[3] = color [ src[ 3 ] >>  4 ];
-				if ( src[ 5 ] & 0xf ) dst[4] = color [ src[ 5 ] & 0xf ];
-				if ( src[ 5 ] >>  4 ) dst[5] = color [ src[ 5 ] >>  4 ];
-				if ( src[ 7 ] & 0xf ) dst[6] = color [ src[ 7 ] & 0xf ];
-				if ( src[ 7 ] >>  4 ) dst[7] = color [ src[ 7 ] >>  4 ];
-			}
-	}
-#else
-      if ( flipx )
-         for(INT32 i=0; i<8; i++, dst-= cps3_gfx_width, src += 8) {
-            if ( src[ 2] & 0xf ) dst[7] = color [ src[ 2] & 0xf ];
-            if ( src[ 2] >>  4 ) dst[6] = color [ src[ 2] >>  4 ];
-            if ( src[ 0] & 0xf ) dst[5] = color [ src[ 0] & 0xf ];
-            if ( src[ 0] >>  4 ) dst[4] = color [ src[ 0] >>  4 ];
-            if ( src[ 6] & 0xf ) dst[3] = color [ src[ 6] & 0xf ];
-            if ( src[ 6] >>  4 ) dst[2] = color [ src[ 6] >>  4 ];
-            if ( src[ 4] & 0xf ) dst[1] = color [ src[ 4] & 0xf ];
-            if ( src[ 4] >>  4 ) dst[0] = color [ src[ 4] >>  4 ];
-         }
-      else
-         for(INT32 i=0; i<8; i++, dst-= cps3_gfx_width, src += 8) {
-            if ( src[ 2] & 0xf ) dst[0] = color [ src[ 2] & 0xf ];
-            if ( src[ 2] >>  4 ) dst[1] = color [ src[ 2] >>  4 ];
-            if ( src[ 0] & 0xf ) dst[2] = color [ src[ 0] & 0xf ];
-            if ( src[ 0] >>  4 ) dst[3] = color [ src[ 0] >>  4 ];
-            if ( src[ 6] & 0xf ) dst[4] = color [ src[ 6] & 0xf ];
-            if ( src[ 6] >>  4 ) dst[5] = color [ src[ 6] >>  4 ];
-            if ( src[ 4] & 0xf ) dst[6] = color [ src[ 4] & 0xf ];
-            if ( src[ 4] >>  4 ) dst[7] = color [ src[ 4] >>  4 ];
-         }
-
-   } else {
-      if ( flipx )
-         for(INT32 i=0; i<8; i++, dst+= cps3_gfx_width, src += 8) {
-            if ( src[ 2] & 0xf ) dst[7] = color [ src[ 2] & 0xf ];
-            if ( src[ 2] >>  4 ) dst[6] = color [ src[ 2] >>  4 ];
-            if ( src[ 0] & 0xf ) dst[5] = color [ src[ 0] & 0xf ];
-            if ( src[ 0] >>  4 ) dst[4] = color [ src[ 0] >>  4 ];
-            if ( src[ 6] & 0xf ) dst[3] = color [ src[ 6] & 0xf ];
-            if ( src[ 6] >>  4 ) dst[2] = color [ src[ 6] >>  4 ];
-            if ( src[ 4] & 0xf ) dst[1] = color [ src[ 4] & 0xf ];
-            if ( src[ 4] >>  4 ) dst[0] = color [ src[ 4] >>  4 ];
-         }
-      else
-         for(INT32 i=0; i<8; i++, dst+= cps3_gfx_width, src += 8) {
-            if ( src[ 2] & 0xf ) dst[0] = color [ src[ 2] & 0xf ];
-            if ( src[ 2] >>  4 ) dst[1] = color [ src[ 2] >>  4 ];
-            if ( src[ 0] & 0xf ) dst[2] = color [ src[ 0] & 0xf ];
-            if ( src[ 0] >>  4 ) dst[3] = color [ src[ 0] >>  4 ];
-            if ( src[ 6] & 0xf ) dst[4] = color [ src[ 6] & 0xf ];
-            if ( src[ 6] >>  4 ) dst[5] = color [ src[ 6] >>  4 ];
-            if ( src[ 4] & 0xf ) dst[6] = color [ src[ 4] & 0xf ];
-            if ( src[ 4] >>  4 ) dst[7] = color [ src[ 4] >>  4 ];
-         }
-   }
-#endif
-}
-
 static void cps3_drawgfxzoom_1(UINT32 code, UINT32 pal, INT32 flipx, INT32 flipy, INT32 x, INT32 y, INT32 drawline)
 {
 	UINT32 * dst = RamScreen;
@@ -1646,6 +3301,7 @@ static void cps3_drawgfxzoom_2(UINT32 code, UINT32 pal, INT32 flipx, INT32 flipy
 			switch( alpha ) {
 			case 0:
 				for( INT32 y=sy; y<ey; y++ ) {
+					if (!cps3_line_sampled[y]) { y_index += dy; continue; }
 					UINT8 * source = source_base + (y_index>>16) * 16;
 					UINT32 * dest = RamScreen + y * 512 * 2;
 					INT32 x_index = x_index_base;
@@ -1663,6 +3319,7 @@ static void cps3_drawgfxzoom_2(UINT32 code, UINT32 pal, INT32 flipx, INT32 flipy
 				break;
 			case 6:
 				for( INT32 y=sy; y<ey; y++ ) {
+					if (!cps3_line_sampled[y]) { y_index += dy; continue; }
 					UINT8 * source = source_base + (y_index>>16) * 16;
 					UINT32 * dest = RamScreen + y * 512 * 2;
 					INT32 x_index = x_index_base;
@@ -1680,6 +3337,7 @@ static void cps3_drawgfxzoom_2(UINT32 code, UINT32 pal, INT32 flipx, INT32 flipy
 				break;
 			case 8:
 				for( INT32 y=sy; y<ey; y++ ) {
+					if (!cps3_line_sampled[y]) { y_index += dy; continue; }
 					UINT8 * source = source_base + (y_index>>16) * 16;
 					UINT32 * dest = RamScreen + y * 512 * 2;
 					INT32 x_index = x_index_base;
@@ -1704,7 +3362,96 @@ static void cps3_drawgfxzoom_2(UINT32 code, UINT32 pal, INT32 flipx, INT32 flipy
 	}
 }
 
-static void cps3_draw_tilemapsprite_line(INT32 drawline, UINT32 * regs )
+// -- Occlusion culling ----------------------------------------------------
+//
+// The screen is split in 16x16 cells. Every sprite tile and tilemap layer
+// drawn in a frame gets a sequence number, and cps3_cover[] holds for each
+// cell the sequence number of the last opaque draw that overwrites the whole
+// cell. Anything with a lower sequence number is hidden there and need not
+// be rasterised. Alpha and shadow sprites only modify what is below them, so
+// they never act as occluders.
+
+#define CPS3_CELL_SHIFT		4
+#define CPS3_CELLS_X		(1024 >> CPS3_CELL_SHIFT)
+#define CPS3_CELLS_Y		(512 >> CPS3_CELL_SHIFT)
+
+static INT32 cps3_cover[CPS3_CELLS_Y][CPS3_CELLS_X];
+
+static INT32 cps3_is_tile_opaque(UINT32 code)
+{
+	if (code >= 0x8000) return 0;
+
+	if (cps3_tile_opaque[code] == 0) {
+		UINT32 * src = RamCRam + code * 64;
+		UINT32 zero = 0;
+		for (INT32 i = 0; i < 64; i++)
+			zero |= (src[i] - 0x01010101) & ~src[i] & 0x80808080;
+		cps3_tile_opaque[code] = zero ? 1 : 2;
+	}
+
+	return cps3_tile_opaque[code] == 2;
+}
+
+// screen area written by cps3_drawgfxzoom_2, after clipping
+static INT32 cps3_sprite_bounds(INT32 sx, INT32 sy, INT32 scalex, INT32 scaley, INT32 * r)
+{
+	INT32 sprite_screen_height = (scaley * 16 + 0x8000) >> 16;
+	INT32 sprite_screen_width  = (scalex * 16 + 0x8000) >> 16;
+	if (!sprite_screen_width || !sprite_screen_height) return 0;
+
+	INT32 ex = sx + sprite_screen_width;
+	INT32 ey = sy + sprite_screen_height;
+
+	if (sx < 0) sx = 0;
+	if (sy < 0) sy = 0;
+	if (ex > cps3_gfx_max_x + 1) ex = cps3_gfx_max_x + 1;
+	if (ey > cps3_gfx_max_y + 1) ey = cps3_gfx_max_y + 1;
+
+	if (ex <= sx || ey <= sy) return 0;
+
+	r[0] = sx; r[1] = sy; r[2] = ex - 1; r[3] = ey - 1;
+	return 1;
+}
+
+static INT32 cps3_area_covered(INT32 seq, INT32 x0, INT32 y0, INT32 x1, INT32 y1)
+{
+	for (INT32 cy = y0 >> CPS3_CELL_SHIFT; cy <= (y1 >> CPS3_CELL_SHIFT); cy++)
+		for (INT32 cx = x0 >> CPS3_CELL_SHIFT; cx <= (x1 >> CPS3_CELL_SHIFT); cx++)
+			if (cps3_cover[cy][cx] <= seq) return 0;
+
+	return 1;
+}
+
+static void cps3_cover_sprite(INT32 seq, UINT32 code, INT32 sx, INT32 sy, INT32 scalex, INT32 scaley)
+{
+	INT32 r[4];
+	if (!cps3_sprite_bounds(sx, sy, scalex, scaley, r)) return;
+
+	// only cells completely inside the visible part of the sprite count, the
+	// ones at the right and bottom screen edge may be cut short by the clip,
+	// as long as the compose pass reads nothing past it
+	INT32 cx0 = (r[0] + 15) >> CPS3_CELL_SHIFT;
+	INT32 cy0 = (r[1] + 15) >> CPS3_CELL_SHIFT;
+	INT32 cx1 = ((r[2] >= cps3_gfx_read_x) ? (r[2] + 16) : (r[2] + 1)) >> CPS3_CELL_SHIFT;
+	INT32 cy1 = ((r[3] >= cps3_gfx_read_y) ? (r[3] + 16) : (r[3] + 1)) >> CPS3_CELL_SHIFT;
+
+	if (cx0 >= cx1 || cy0 >= cy1) return;
+	if (!cps3_is_tile_opaque(code)) return;
+
+	for (INT32 cy = cy0; cy < cy1; cy++)
+		for (INT32 cx = cx0; cx < cx1; cx++)
+			cps3_cover[cy][cx] = seq;
+}
+
+static INT32 cps3_sprite_culled(INT32 seq, INT32 sx, INT32 sy, INT32 scalex, INT32 scaley)
+{
+	INT32 r[4];
+	if (!cps3_sprite_bounds(sx, sy, scalex, scaley, r)) return 1;
+
+	return cps3_area_covered(seq, r[0], r[1], r[2], r[3]);
+}
+
+static void cps3_draw_tilemapsprite_line(INT32 drawline, UINT32 * regs, INT32 seq, UINT64 * opaque)
 {
 	INT32 scrolly =  ((regs[0]&0x0000ffff)>>0)+4;
 	INT32 line = drawline + scrolly;
@@ -1733,6 +3480,9 @@ static void cps3_draw_tilemapsprite_line(INT32 drawline, UINT32 * regs )
 
 		if (drawline>cps3_gfx_max_y+4) return;
 
+		// cover pass: flag the cells of this line that get fully overwritten
+		UINT64 solid = 0;
+
 		for (INT32 x=0;x<(cps3_gfx_max_x/16)+2;x++) {
 
 			UINT32 dat;
@@ -1748,19 +3498,425 @@ static void cps3_draw_tilemapsprite_line(INT32 drawline, UINT32 * regs )
 			yflip  = (dat & 0x00000800)>>11;
 			xflip  = (dat & 0x00001000)>>12;
 
+			if (opaque) {
+				if (cps3_is_tile_opaque(tileno)) solid |= (UINT64)1 << x;
+				continue;
+			}
+
+			// nothing of it is read back, or a later opaque draw hides it (tiles
+			// aren't clipped, so at small zooms they show past cps3_gfx_max_x/y)
+			INT32 sx = (x*16)-scrollx%16;
+			if (sx + 15 < 0 || sx > cps3_gfx_read_x || drawline > cps3_gfx_read_y) continue;
+			if (cps3_area_covered(seq, (sx < 0) ? 0 : sx, drawline, (sx + 15 > cps3_gfx_read_x) ? cps3_gfx_read_x : sx + 15, drawline)) continue;
+
 			if (!bpp) colour <<= 8;
 			else colour <<= 6;
 
-			cps3_drawgfxzoom_1(tileno,colour,xflip,yflip,(x*16)-scrollx%16,drawline-tilesubline, drawline);
+			cps3_drawgfxzoom_1(tileno,colour,xflip,yflip,sx,drawline-tilesubline, drawline);
+		}
+
+		if (opaque) {
+			// tile x spans [x*16 - scrollx%16, x*16 - scrollx%16 + 15], so
+			// unless it is aligned a cell needs two solid tiles
+			if (scrollx % 16) solid &= solid >> 1;
+			*opaque = solid;
+		}
+	}
+}
+
+static void cps3_cover_tilemap(INT32 seq, UINT32 * regs, UINT32 fsz)
+{
+	UINT64 rows[CPS3_CELLS_Y];
+	UINT8 seen[CPS3_CELLS_Y];
+	memset(seen, 0, sizeof(seen));
+
+	UINT32 srcy = 0;
+	for (INT32 ry = 0; ry < 224; ry += 1 << cps3_preview_shift, srcy += fsz << cps3_preview_shift) {
+		INT32 drawline = srcy >> 16;
+		INT32 cy = drawline >> CPS3_CELL_SHIFT;
+		UINT64 solid = 0;
+
+		cps3_draw_tilemapsprite_line(drawline, regs, seq, &solid);
+
+		rows[cy] = seen[cy] ? (rows[cy] & solid) : solid;
+		seen[cy] = 1;
+	}
+
+	// the compose pass only ever reads back the lines visited above, so a
+	// row of cells is hidden once each of those lines is
+	for (INT32 cy = 0; cy < CPS3_CELLS_Y; cy++) {
+		if (!seen[cy] || !rows[cy]) continue;
+		for (INT32 cx = 0; cx < 64; cx++)
+			if (rows[cy] & ((UINT64)1 << cx)) cps3_cover[cy][cx] = seq;
+	}
+}
+
+// walks the sprite list twice: first to find what is hidden, then to draw
+static void cps3_draw_sprites(UINT32 fsz, INT32 cover_pass)
+{
+	INT32 bg_drawn[4] = { 0, 0, 0, 0 };
+	INT32 seq = 0;
+
+	for (INT32 i=0x00000/4;i<0x2000/4;i+=4) {
+		INT32 xpos		= (RamSpr[i+1]&0x03ff0000)>>16;
+		INT32 ypos		= (RamSpr[i+1]&0x000003ff)>>0;
+
+		INT32 gscroll		= (RamSpr[i+0]&0x70000000)>>28;
+		INT32 length		= (RamSpr[i+0]&0x01ff0000)>>14; // how many entries in the sprite table
+		UINT32 start		= (RamSpr[i+0]&0x00007ff0)>>4;
+
+		INT32 whichbpp		= (RamSpr[i+2]&0x40000000)>>30; // not 100% sure if this is right, jojo title / characters
+		INT32 whichpal		= (RamSpr[i+2]&0x20000000)>>29;
+		INT32 global_xflip	= (RamSpr[i+2]&0x10000000)>>28;
+		INT32 global_yflip	= (RamSpr[i+2]&0x08000000)>>27;
+		INT32 global_alpha	= (RamSpr[i+2]&0x04000000)>>26; // alpha / shadow? set on sfiii2 shadows, and big black image in jojo intro
+		INT32 global_bpp	= (RamSpr[i+2]&0x02000000)>>25;
+		INT32 global_pal	= (RamSpr[i+2]&0x01ff0000)>>16;
+
+		INT32 gscrollx		= (RamVReg[gscroll]&0x03ff0000)>>16;
+		INT32 gscrolly		= (RamVReg[gscroll]&0x000003ff)>>0;
+		
+		start = (start * 0x100) >> 2;
+
+		if ((RamSpr[i+0]&0xf0000000) == 0x80000000) break;	
+	
+		for (INT32 j=0; j<length; j+=4) {
+			
+			UINT32 value1 = (RamSpr[start+j+0]);
+			UINT32 value2 = (RamSpr[start+j+1]);
+			UINT32 value3 = (RamSpr[start+j+2]);
+			UINT32 tileno = (value1&0xfffe0000)>>17;
+			INT32 count;
+			INT32 xpos2 = (value2 & 0x03ff0000)>>16;
+			INT32 ypos2 = (value2 & 0x000003ff)>>0;
+			INT32 flipx = (value1 & 0x00001000)>>12;
+			INT32 flipy = (value1 & 0x00000800)>>11;
+			INT32 alpha = (value1 & 0x00000400)>>10; //? this one is used for alpha effects on warzard
+			INT32 bpp =   (value1 & 0x00000200)>>9;
+			INT32 pal =   (value1 & 0x000001ff);
+
+			INT32 ysizedraw2 = ((value3 & 0x7f000000)>>24);
+			INT32 xsizedraw2 = ((value3 & 0x007f0000)>>16);
+			INT32 xx,yy;
+
+			INT32 tilestable[4] = { 8,1,2,4 };
+			INT32 ysize2 = ((value3 & 0x0000000c)>>2);
+			INT32 xsize2 = ((value3 & 0x00000003)>>0);
+			UINT32 xinc,yinc;
+
+			if (ysize2==0) continue;
+
+			if (xsize2==0)
+			{
+				if (nBurnLayer & 1)
+				{
+					INT32 tilemapnum = ((value3 & 0x00000030)>>4);
+					INT32 startline;
+					INT32 endline;
+					INT32 height = (value3 & 0x7f000000)>>24;
+					UINT32 * regs;
+
+					regs = RamVReg + 8 + tilemapnum * 4;
+					endline = value2;
+					startline = endline - height;
+
+					startline &=0x3ff;
+					endline &=0x3ff;
+
+					if (bg_drawn[tilemapnum]==0)
+					{
+						if (cover_pass) {
+							cps3_cover_tilemap(seq, regs, fsz);
+						} else {
+							UINT32 srcy = 0;
+							for (INT32 ry = 0; ry < 224; ry += 1 << cps3_preview_shift, srcy += fsz << cps3_preview_shift) {
+								cps3_draw_tilemapsprite_line( srcy >> 16, regs, seq, NULL );
+							}
+						}
+						seq++;
+					}
+
+					bg_drawn[tilemapnum] = 1;
+				}
+			} else {
+				if (~nSpriteEnable & 1) continue;
+
+				ysize2 = tilestable[ysize2];
+				xsize2 = tilestable[xsize2];
+
+				xinc = ((xsizedraw2+1)<<16) / ((xsize2*0x10));
+				yinc = ((ysizedraw2+1)<<16) / ((ysize2*0x10));
+
+				xsize2-=1;
+				ysize2-=1;
+
+				flipx ^= global_xflip;
+				flipy ^= global_yflip;
+
+				if (!flipx) xpos2+=((xsizedraw2+1)/2);
+				else xpos2-=((xsizedraw2+1)/2);
+
+				ypos2+=((ysizedraw2+1)/2);
+
+				if (!flipx) xpos2-= (((xsize2+1)*16*xinc)>>16);
+				else  xpos2+= (((xsize2)*16*xinc)>>16);
+
+				if (flipy) ypos2-= ((ysize2*16*yinc)>>16);
+
+				{
+					count = 0;
+					for (xx=0;xx<xsize2+1;xx++) {
+						INT32 current_xpos;
+
+						if (!flipx) current_xpos = (xpos+xpos2+((xx*16*xinc)>>16)  );
+						else current_xpos = (xpos+xpos2-((xx*16*xinc)>>16));
+
+						current_xpos += gscrollx;
+						current_xpos += 1;
+						current_xpos &=0x3ff;
+						if (current_xpos&0x200) current_xpos-=0x400;
+
+						for (yy=0;yy<ysize2+1;yy++) {
+							INT32 current_ypos;
+							INT32 actualpal;
+
+							if (flipy) current_ypos = (ypos+ypos2+((yy*16*yinc)>>16));
+							else current_ypos = (ypos+ypos2-((yy*16*yinc)>>16));
+
+							current_ypos += gscrolly;
+							current_ypos = 0x3ff-current_ypos;
+							current_ypos -= 17;
+							current_ypos &=0x3ff;
+
+							if (current_ypos&0x200) current_ypos-=0x400;
+
+							/* use the palette value from the main list or the sublists? */
+							if (whichpal) actualpal = global_pal;
+							else actualpal = pal;
+							
+							/* use the bpp value from the main list or the sublists? */
+							INT32 color_granularity;
+							if (whichbpp) {
+								if (!global_bpp) color_granularity = 8;
+								else color_granularity = 6;
+							} else {
+								if (!bpp) color_granularity = 8;
+								else color_granularity = 6;
+							}
+							actualpal <<= color_granularity;
+
+							{
+								INT32 realtileno = tileno+count;
+
+								if ( realtileno ) {
+									INT32 blend = 0;
+
+									if (global_alpha || alpha) {
+										// fix jojo's title in it's intro ???
+										if ( global_alpha && (global_pal & 0x100))
+											actualpal &= 0x0ffff;
+
+										blend = color_granularity;
+									}
+
+									if (cover_pass) {
+										if (blend == 0) cps3_cover_sprite(seq, realtileno, current_xpos, current_ypos, xinc, yinc);
+									} else {
+										if (!cps3_sprite_culled(seq, current_xpos, current_ypos, xinc, yinc))
+											cps3_drawgfxzoom_2(realtileno,actualpal,flipx,flipy,current_xpos,current_ypos,xinc,yinc, blend);
+									}
+									seq++;
+								}
+								count++;
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// -- Text layer -------------------------------------------------------------
+//
+// The 8x8 4bpp tiles of the text layer are kept resolved to output pixels in
+// a small direct mapped cache, tagged with the generation of the tile data
+// and of the palette line they were built from.
+
+static void cps3_build_glyph(cps3_glyph * g, UINT32 tile, UINT32 pal, INT32 flipx, INT32 flipy)
+{
+	UINT8 * src = (UINT8 *)RamSS + (tile + 0x200) * 64;
+	UINT16 * color = Cps3CurPal + (pal << 4);
+	INT32 opaque = 0;
+
+	for (INT32 i = 0; i < 8; i++, src += 8) {
+#ifdef MSB_FIRST
+		UINT8 b[4] = { src[1], src[3], src[5], src[7] };
+#else
+		UINT8 b[4] = { src[2], src[0], src[6], src[4] };
+#endif
+		INT32 row = (flipy ? (7 - i) : i) * 8;
+
+		for (INT32 j = 0; j < 8; j++) {
+			INT32 c = (j & 1) ? (b[j >> 1] >> 4) : (b[j >> 1] & 0x0f);
+			INT32 col = flipx ? (7 - j) : j;
+
+			g->pix[row + col] = c ? color[c] : 0;
+			g->mask[row + col] = c ? 0xffff : 0;
+			if (c) opaque++;
+		}
+	}
+
+	g->solid = (opaque == 0) ? 0 : ((opaque == 64) ? 2 : 1);
+}
+
+static void cps3_blit_glyph(cps3_glyph * g, UINT16 * dst)
+{
+	if (g->solid == 0) return;
+
+	if (cps3_preview_shift) {
+		INT32 step = 1 << cps3_preview_shift;
+
+		for (INT32 i = 0; i < 8; i += step, dst += cps3_gfx_width >> cps3_preview_shift)
+			for (INT32 j = 0; j < 8; j += step)
+				if (g->mask[i * 8 + j]) dst[j >> cps3_preview_shift] = g->pix[i * 8 + j];
+		return;
+	}
+
+	for (INT32 i = 0; i < 8; i++, dst += cps3_gfx_width) {
+		UINT16 * pix = g->pix + i * 8;
+
+		if (g->solid == 2) {
+			memcpy(dst, pix, 8 * sizeof(UINT16));
+			continue;
+		}
+
+#if defined CPS3_SSE2
+		__m128i d = _mm_loadu_si128((__m128i *)dst);
+		d = _mm_andnot_si128(_mm_loadu_si128((__m128i *)(g->mask + i * 8)), d);
+		_mm_storeu_si128((__m128i *)dst, _mm_or_si128(d, _mm_loadu_si128((__m128i *)pix)));
+#elif defined CPS3_NEON
+		vst1q_u16(dst, vbslq_u16(vld1q_u16(g->mask + i * 8), vld1q_u16(pix), vld1q_u16(dst)));
+#else
+		UINT16 * mask = g->mask + i * 8;
+		for (INT32 j = 0; j < 8; j++)
+			dst[j] = (dst[j] & ~mask[j]) | pix[j];
+#endif
+	}
+}
+
+static void cps3_draw_glyph(UINT32 tile, UINT32 pal, INT32 flipx, INT32 flipy, INT32 x, INT32 y)
+{
+	if ((x > (cps3_gfx_width - 8)) || (y > (cps3_gfx_height - 8))) return;
+
+	UINT16 * dst = (UINT16 *)pBurnDraw + ((y >> cps3_preview_shift) * (cps3_gfx_width >> cps3_preview_shift) + (x >> cps3_preview_shift));
+
+	if (pal >= 0x2000) {
+		// past the end of the palette, not worth caching
+		cps3_glyph g;
+		cps3_build_glyph(&g, tile, pal, flipx, flipy);
+		cps3_blit_glyph(&g, dst);
+		return;
+	}
+
+	UINT32 key = tile | (flipx ? 0x200 : 0) | (flipy ? 0x400 : 0) | (pal << 11);
+	cps3_glyph * g = Cps3Glyphs + ((key ^ (key >> 11) * 0x9e5) & (CPS3_GLYPH_SLOTS - 1));
+
+	if (g->key != key || g->ss_gen != cps3_ss_gen[tile] || g->pal_gen != cps3_pal_line_gen[pal]) {
+		cps3_build_glyph(g, tile, pal, flipx, flipy);
+		g->key = key;
+		g->ss_gen = cps3_ss_gen[tile];
+		g->pal_gen = cps3_pal_line_gen[pal];
+	}
+
+	cps3_blit_glyph(g, dst);
+}
+
+// text layer tile data lives in the upper half of RamSS
+static INT32 cps3_sync_glyphs()
+{
+	INT32 changed = 0;
+
+	for (INT32 i = 0; i < 0x200; i++) {
+		UINT32 * src = RamSS + (i + 0x200) * 16;
+		UINT32 * shadow = RamSSLast + (i + 0x200) * 16;
+
+		if (memcmp(shadow, src, 64)) {
+			memcpy(shadow, src, 64);
+			cps3_ss_gen[i]++;
+			changed = 1;
 		}
 	}
+
+	return changed;
 }
 
 static INT32 WideScreenFrameDelay = 0;
 
+static struct {
+	UINT32 pal_gen, cram_gen;
+	UINT32 fsz;
+	UINT32 ss_bank_base, ss_pal_base;
+	INT32 width, height, shift;
+	UINT8 layer, sprite;
+	UINT8 * draw;
+} cps3_drawn;
+
+// copy the parts of src that differ from the shadow, non-zero if there were any
+static INT32 cps3_sync_shadow(UINT32 * shadow, UINT32 * src, INT32 len)
+{
+	INT32 changed = 0;
+
+	for (INT32 i = 0; i < len; i += 0x1000) {
+		INT32 n = (len - i < 0x1000) ? (len - i) : 0x1000;
+		if (memcmp((UINT8 *)shadow + i, (UINT8 *)src + i, n)) {
+			memcpy((UINT8 *)shadow + i, (UINT8 *)src + i, n);
+			changed = 1;
+		}
+	}
+
+	return changed;
+}
+
+// rebuild RamScreen
+static void cps3_draw_layers(UINT32 fsz)
+{
+	// in preview mode only every 2nd or 4th output line is rendered
+	memset(cps3_line_sampled, cps3_preview_shift ? 0 : 1, sizeof(cps3_line_sampled));
+	if (cps3_preview_shift) {
+		for (INT32 ry = 0; ry < 224; ry += 1 << cps3_preview_shift)
+			cps3_line_sampled[(ry * fsz) >> 16] = 1;
+	}
+
+	if (nBurnLayer & 1)
+	{
+		UINT32 * pscr = RamScreen;
+		INT32 clrsz = (cps3_gfx_max_x + 1) * sizeof(INT32);
+		for(INT32 yy = 0; yy<=cps3_gfx_max_y; yy++, pscr += 512*2)
+			if (cps3_line_sampled[yy]) memset(pscr, 0, clrsz);
+	}
+	else
+	{
+		Cps3CurPal[0x20000] = BurnHighCol(0xff, 0x00, 0xff, 0);
+
+		INT32 i;
+		for (i = 0; i < 1024 * 448; i++) {
+			RamScreen[i] = 0x20000;
+		}
+	}
+	
+	// Draw Sprites
+	for (INT32 cy = 0; cy < CPS3_CELLS_Y; cy++)
+		for (INT32 cx = 0; cx < CPS3_CELLS_X; cx++)
+			cps3_cover[cy][cx] = -1;
+
+	cps3_draw_sprites(fsz, 1);
+	cps3_draw_sprites(fsz, 0);
+}
+
 static void DrvDraw()
 {
-	INT32 bg_drawn[4] = { 0, 0, 0, 0 };
+	cps3_chardma_sync();
 
 	UINT32 fullscreenzoom = RamVReg[ 6 * 4 + 3 ] & 0xff;
 	UINT32 fullscreenzoomwidecheck = RamVReg[6 * 4 + 1];
@@ -1792,207 +3948,60 @@ static void DrvDraw()
 	
 	cps3_gfx_max_x = ((cps3_gfx_width * fsz)  >> 16) - 1;	// 384 ( 496 for SFIII2 Only)
 	cps3_gfx_max_y = ((cps3_gfx_height * fsz) >> 16) - 1;	// 224
-
-	if (nBurnLayer & 1)
-	{
-		UINT32 * pscr = RamScreen;
-		INT32 clrsz = (cps3_gfx_max_x + 1) * sizeof(INT32);
-		for(INT32 yy = 0; yy<=cps3_gfx_max_y; yy++, pscr += 512*2)
-			memset(pscr, 0, clrsz);
-	}
-	else
-	{
-		Cps3CurPal[0x20000] = BurnHighCol(0xff, 0x00, 0xff, 0);
-
-		INT32 i;
-		for (i = 0; i < 1024 * 448; i++) {
-			RamScreen[i] = 0x20000;
-		}
+	cps3_gfx_read_x = ((cps3_gfx_width - 1) * fsz) >> 16;
+	cps3_gfx_read_y = (223 * fsz) >> 16;
+
+	// RamScreen only depends on the sprite list, the video registers and
+	// character RAM, so a palette fade or a text layer update just needs the
+	// colour pass redone. If nothing changed at all the frame is a dupe.
+	INT32 layout_changed = cps3_redraw;
+	layout_changed |= cps3_sync_shadow(RamSprLast, RamSpr, 0x80000);
+	layout_changed |= cps3_sync_shadow(RamVRegLast, RamVReg, 0x100);
+	layout_changed |= (cps3_cram_gen != cps3_drawn.cram_gen) || (fsz != cps3_drawn.fsz);
+	layout_changed |= (cps3_gfx_width != cps3_drawn.width) || (cps3_gfx_height != cps3_drawn.height);
+	layout_changed |= (cps3_preview_shift != cps3_drawn.shift);
+	layout_changed |= (nBurnLayer != cps3_drawn.layer) || (nSpriteEnable != cps3_drawn.sprite);
+
+	INT32 colour_changed = layout_changed;
+	colour_changed |= cps3_sync_shadow(RamSSLast, RamSS, 0x8000);
+	colour_changed |= cps3_sync_glyphs();
+	colour_changed |= (cps3_pal_gen != cps3_drawn.pal_gen) || (pBurnDraw != cps3_drawn.draw);
+	colour_changed |= (ss_bank_base != cps3_drawn.ss_bank_base) || (ss_pal_base != cps3_drawn.ss_pal_base);
+
+	cps3_drawn.pal_gen = cps3_pal_gen;
+	cps3_drawn.cram_gen = cps3_cram_gen;
+	cps3_drawn.fsz = fsz;
+	cps3_drawn.ss_bank_base = ss_bank_base;
+	cps3_drawn.ss_pal_base = ss_pal_base;
+	cps3_drawn.width = cps3_gfx_width;
+	cps3_drawn.height = cps3_gfx_height;
+	cps3_drawn.shift = cps3_preview_shift;
+	cps3_drawn.layer = nBurnLayer;
+	cps3_drawn.sprite = nSpriteEnable;
+	cps3_drawn.draw = pBurnDraw;
+	cps3_redraw = 0;
+
+	if (!colour_changed) {
+		bBurnFrameUnchanged = true;
+		return;
 	}
-	
-	// Draw Sprites
-	{
-		for (INT32 i=0x00000/4;i<0x2000/4;i+=4) {
-			INT32 xpos		= (RamSpr[i+1]&0x03ff0000)>>16;
-			INT32 ypos		= (RamSpr[i+1]&0x000003ff)>>0;
-
-			INT32 gscroll		= (RamSpr[i+0]&0x70000000)>>28;
-			INT32 length		= (RamSpr[i+0]&0x01ff0000)>>14; // how many entries in the sprite table
-			UINT32 start		= (RamSpr[i+0]&0x00007ff0)>>4;
-
-			INT32 whichbpp		= (RamSpr[i+2]&0x40000000)>>30; // not 100% sure if this is right, jojo title / characters
-			INT32 whichpal		= (RamSpr[i+2]&0x20000000)>>29;
-			INT32 global_xflip	= (RamSpr[i+2]&0x10000000)>>28;
-			INT32 global_yflip	= (RamSpr[i+2]&0x08000000)>>27;
-			INT32 global_alpha	= (RamSpr[i+2]&0x04000000)>>26; // alpha / shadow? set on sfiii2 shadows, and big black image in jojo intro
-			INT32 global_bpp	= (RamSpr[i+2]&0x02000000)>>25;
-			INT32 global_pal	= (RamSpr[i+2]&0x01ff0000)>>16;
-
-			INT32 gscrollx		= (RamVReg[gscroll]&0x03ff0000)>>16;
-			INT32 gscrolly		= (RamVReg[gscroll]&0x000003ff)>>0;
-			
-			start = (start * 0x100) >> 2;
-
-			if ((RamSpr[i+0]&0xf0000000) == 0x80000000) break;	
-		
-			for (INT32 j=0; j<length; j+=4) {
-				
-				UINT32 value1 = (RamSpr[start+j+0]);
-				UINT32 value2 = (RamSpr[start+j+1]);
-				UINT32 value3 = (RamSpr[start+j+2]);
-				UINT32 tileno = (value1&0xfffe0000)>>17;
-				INT32 count;
-				INT32 xpos2 = (value2 & 0x03ff0000)>>16;
-				INT32 ypos2 = (value2 & 0x000003ff)>>0;
-				INT32 flipx = (value1 & 0x00001000)>>12;
-				INT32 flipy = (value1 & 0x00000800)>>11;
-				INT32 alpha = (value1 & 0x00000400)>>10; //? this one is used for alpha effects on warzard
-				INT32 bpp =   (value1 & 0x00000200)>>9;
-				INT32 pal =   (value1 & 0x000001ff);
-
-				INT32 ysizedraw2 = ((value3 & 0x7f000000)>>24);
-				INT32 xsizedraw2 = ((value3 & 0x007f0000)>>16);
-				INT32 xx,yy;
-
-				INT32 tilestable[4] = { 8,1,2,4 };
-				INT32 ysize2 = ((value3 & 0x0000000c)>>2);
-				INT32 xsize2 = ((value3 & 0x00000003)>>0);
-				UINT32 xinc,yinc;
-
-				if (ysize2==0) continue;
-
-				if (xsize2==0)
-				{
-					if (nBurnLayer & 1)
-					{
-						INT32 tilemapnum = ((value3 & 0x00000030)>>4);
-						INT32 startline;
-						INT32 endline;
-						INT32 height = (value3 & 0x7f000000)>>24;
-						UINT32 * regs;
-
-						regs = RamVReg + 8 + tilemapnum * 4;
-						endline = value2;
-						startline = endline - height;
-
-						startline &=0x3ff;
-						endline &=0x3ff;
-
-						if (bg_drawn[tilemapnum]==0)
-						{
-							UINT32 srcy = 0;
-							for (INT32 ry = 0; ry < 224; ry++, srcy += fsz) {
-								cps3_draw_tilemapsprite_line( srcy >> 16, regs );
-							}
-						}
-
-						bg_drawn[tilemapnum] = 1;
-					}
-				} else {
-					if (~nSpriteEnable & 1) continue;
-
-					ysize2 = tilestable[ysize2];
-					xsize2 = tilestable[xsize2];
-
-					xinc = ((xsizedraw2+1)<<16) / ((xsize2*0x10));
-					yinc = ((ysizedraw2+1)<<16) / ((ysize2*0x10));
-
-					xsize2-=1;
-					ysize2-=1;
-
-					flipx ^= global_xflip;
-					flipy ^= global_yflip;
-
-					if (!flipx) xpos2+=((xsizedraw2+1)/2);
-					else xpos2-=((xsizedraw2+1)/2);
 
-					ypos2+=((ysizedraw2+1)/2);
+	if (layout_changed) cps3_draw_layers(fsz);
 
-					if (!flipx) xpos2-= (((xsize2+1)*16*xinc)>>16);
-					else  xpos2+= (((xsize2)*16*xinc)>>16);
-
-					if (flipy) ypos2-= ((ysize2*16*yinc)>>16);
-
-					{
-						count = 0;
-						for (xx=0;xx<xsize2+1;xx++) {
-							INT32 current_xpos;
-
-							if (!flipx) current_xpos = (xpos+xpos2+((xx*16*xinc)>>16)  );
-							else current_xpos = (xpos+xpos2-((xx*16*xinc)>>16));
-
-							current_xpos += gscrollx;
-							current_xpos += 1;
-							current_xpos &=0x3ff;
-							if (current_xpos&0x200) current_xpos-=0x400;
-
-							for (yy=0;yy<ysize2+1;yy++) {
-								INT32 current_ypos;
-								INT32 actualpal;
-
-								if (flipy) current_ypos = (ypos+ypos2+((yy*16*yinc)>>16));
-								else current_ypos = (ypos+ypos2-((yy*16*yinc)>>16));
-
-								current_ypos += gscrolly;
-								current_ypos = 0x3ff-current_ypos;
-								current_ypos -= 17;
-								current_ypos &=0x3ff;
-
-								if (current_ypos&0x200) current_ypos-=0x400;
-
-								/* use the palette value from the main list or the sublists? */
-								if (whichpal) actualpal = global_pal;
-								else actualpal = pal;
-								
-								/* use the bpp value from the main list or the sublists? */
-								INT32 color_granularity;
-								if (whichbpp) {
-									if (!global_bpp) color_granularity = 8;
-									else color_granularity = 6;
-								} else {
-									if (!bpp) color_granularity = 8;
-									else color_granularity = 6;
-								}
-								actualpal <<= color_granularity;
-
-								{
-									INT32 realtileno = tileno+count;
-
-									if ( realtileno ) {
-										if (global_alpha || alpha) {
-											// fix jojo's title in it's intro ???
-											if ( global_alpha && (global_pal & 0x100))
-												actualpal &= 0x0ffff;
-												
-											cps3_drawgfxzoom_2(realtileno,actualpal,flipx,flipy,current_xpos,current_ypos,xinc,yinc, color_granularity);
-											
-										} else {
-											cps3_drawgfxzoom_2(realtileno,actualpal,flipx,flipy,current_xpos,current_ypos,xinc,yinc, 0);
-										}
-									}
-									count++;
-								}
-							}
-						}
-					}
-				}
-			}
-		}
-	}
-	
 	{
 		UINT32 srcx, srcy = 0;
 		UINT32 * srcbitmap;
 		UINT16 * dstbitmap = (UINT16 * )pBurnDraw;
+		UINT32 step = fsz << cps3_preview_shift;
 
-		for (INT32 rendery=0; rendery<224; rendery++) {
+		for (INT32 rendery=0; rendery<(224 >> cps3_preview_shift); rendery++) {
 			srcbitmap = RamScreen + (srcy >> 16) * 1024;
 			srcx=0;
-			for (INT32 renderx=0; renderx<cps3_gfx_width; renderx++, dstbitmap ++) {
+			for (INT32 renderx=0; renderx<(cps3_gfx_width >> cps3_preview_shift); renderx++, dstbitmap ++) {
 				*dstbitmap = Cps3CurPal[ srcbitmap[srcx>>16] ];
-				srcx += fsz;
+				srcx += step;
 			}
-			srcy += fsz;
+			srcy += step;
 		}
 	}
 	
@@ -2011,8 +4020,7 @@ static void DrvDraw()
 
 				if (tile == 0) continue; // ok?
 
-				tile+=0x200;
-				cps3_drawgfxzoom_0(tile,pal,flipx,flipy,x*8,y*8);
+				cps3_draw_glyph(tile,pal,flipx,flipy,x*8,y*8);
 			}
 		}
 	}
@@ -2026,22 +4034,13 @@ INT32 cps3Frame()
 		Cps3Reset();
 		
 	if (cps3_palette_change) {
-		for(INT32 i=0;i<0x0020000;i++) {
-#ifdef MSB_FIRST
-			INT32 data = RamPal[i];
-#else
-			INT32 data = RamPal[i ^ 1];
-#endif
-			INT32 r = (data & 0x001F) << 3;	// Red
-			INT32 g = (data & 0x03E0) >> 2;	// Green
-			INT32 b = (data & 0x7C00) >> 7;	// Blue
-			r |= r >> 5;
-			g |= g >> 5;
-			b |= b >> 5;
-			Cps3CurPal[i] = BurnHighCol(r, g, b, 0);	
-		}
+		// output format changed
+		cps3_pal_lut_build();
+		cps3_pal_dirty(0, 0x20000);
 		cps3_palette_change = 0;
 	}
+
+	cps3_pal_flush();
 	
 	if (WideScreenFrameDelay == GetCurrentFrame()) {
 		BurnDrvGetVisibleSize(&cps3_gfx_width, &cps3_gfx_height);
@@ -2065,6 +4064,8 @@ INT32 cps3Frame()
 	Cps3ClearOpposites(&Cps3Input[0]);
 	Cps3ClearOpposites(&Cps3Input[1]);
 
+	UINT64 nTime = BurnGetTime();
+
 	for (INT32 i=0; i<4; i++) {
 
 		Sh2Run(6250000 * 4 / 60 / 4);
@@ -2077,11 +4078,20 @@ INT32 cps3Frame()
 	}
 	Sh2SetIRQLine(12, SH2_IRQSTATUS_AUTO);
 
+	nBurnFrameTimeCpu = (UINT32)(BurnGetTime() - nTime);
+	nTime += nBurnFrameTimeCpu;
+
 	cps3SndUpdate();
+
+	nBurnFrameTimeSound = (UINT32)(BurnGetTime() - nTime);
+	nTime += nBurnFrameTimeSound;
 	
 //	bprintf(0, _T("PC: %08x\n"), Sh2GetPC(0));
 	
-	if (pBurnDraw) DrvDraw();
+	if (pBurnDraw) {
+		DrvDraw();
+		nBurnFrameTimeDraw = (UINT32)(BurnGetTime() - nTime);
+	}
 
 	return 0;
 }
@@ -2090,6 +4100,8 @@ INT32 cps3Scan(INT32 nAction, INT32 *pnMin)
 {
 	if (pnMin) *pnMin =  0x029672;
 
+	cps3_chardma_sync();
+
 	struct BurnArea ba;
 	
 	if (nAction & ACB_NVRAM) {
@@ -2187,10 +4199,13 @@ INT32 cps3Scan(INT32 nAction, INT32 *pnMin)
 		if (nAction & ACB_WRITE) {
 			
 			// rebuild current palette
-			cps3_palette_change = 1;
+			cps3_pal_dirty(0, 0x20000);
 			
 			// remap RamCRam
-			Sh2MapMemory(((UINT8 *)RamCRam) + (cram_bank << 20), 0x04100000, 0x041fffff, SH2_RAM);
+			cps3_map_cram();
+
+			cps3_cram_written(0, 0x800000);
+			cps3_redraw = 1;
 			
 		}
 		
@@ -147,6 +147,10 @@ void cps3SndUpdate()
 	INT8 * base = (INT8 *)chip->rombase;
 	cps3_voice *vptr = &chip->voice[0];
 
+	// without a rom base the samples are fetched a 64KB block at a time
+	INT8 * block = NULL;
+	UINT32 block_num = ~0;
+
 	for(INT32 i=0; i<CPS3_VOICES; i++, vptr++) {
 		if (chip->key & (1 << i)) {
 			
@@ -182,7 +186,16 @@ void cps3SndUpdate()
 				}
 
 				// 8bit sample store with 16bit bigend ???
-				sample = base[(start + pos) ^ 1];
+				if (base) {
+					sample = base[(start + pos) ^ 1];
+				} else {
+					UINT32 a = (start + pos) ^ 1;
+					if ((a >> 16) != block_num) {
+						block_num = a >> 16;
+						block = (INT8 *)cps3_user_block(block_num);
+					}
+					sample = block[a & 0xffff];
+				}
 				frac += step;
 
 				INT32 nLeftSample = 0, nRightSample = 0;
@@ -1,5 +1,98 @@
 // Burn - Rom Loading module
 #include "burnint.h"
+#include "burn_thread.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define LOAD_SSE2	1
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#define LOAD_AVX2	1
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define LOAD_NEON	1
+#include <arm_neon.h>
+#endif
+
+// Put nLen bytes from pSrc into (or xor them with) every nGap'th byte of Dest.
+// The vector loops rewrite the bytes in between as they were, and stop short of
+// the last one so nothing past Dest + (nLen - 1) * nGap is touched.
+static void Spread(UINT8 *Dest, UINT8 *pSrc, INT32 nLen, INT32 nGap, INT32 bXor)
+{
+  INT32 n = 0;
+
+#if defined LOAD_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  if (nGap == 2)
+  {
+    // the source bytes zero-extended to words, so or-ing and xor-ing are the same
+    const __m128i keep = bXor ? _mm_set1_epi8(-1) : _mm_set1_epi16((short)0xff00);
+    for (; n + 16 < nLen; n += 16, Dest += 32)
+    {
+      __m128i s = _mm_loadu_si128((__m128i *)(pSrc + n));
+      __m128i d0 = _mm_loadu_si128((__m128i *)(Dest +  0));
+      __m128i d1 = _mm_loadu_si128((__m128i *)(Dest + 16));
+      _mm_storeu_si128((__m128i *)(Dest +  0), _mm_xor_si128(_mm_and_si128(d0, keep), _mm_unpacklo_epi8(s, zero)));
+      _mm_storeu_si128((__m128i *)(Dest + 16), _mm_xor_si128(_mm_and_si128(d1, keep), _mm_unpackhi_epi8(s, zero)));
+    }
+  }
+  else if (nGap == 4)
+  {
+    const __m128i keep = bXor ? _mm_set1_epi8(-1) : _mm_set1_epi32((int)0xffffff00);
+    for (; n + 16 < nLen; n += 16, Dest += 64)
+    {
+      __m128i s = _mm_loadu_si128((__m128i *)(pSrc + n));
+      __m128i lo = _mm_unpacklo_epi8(s, zero), hi = _mm_unpackhi_epi8(s, zero);
+      __m128i w[4] = { _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero), _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero) };
+      for (INT32 j = 0; j < 4; j++)
+      {
+        __m128i d = _mm_loadu_si128((__m128i *)(Dest + j * 16));
+        _mm_storeu_si128((__m128i *)(Dest + j * 16), _mm_xor_si128(_mm_and_si128(d, keep), w[j]));
+      }
+    }
+  }
+#elif defined LOAD_NEON
+  if (nGap == 2)
+  {
+    for (; n + 16 < nLen; n += 16, Dest += 32)
+    {
+      uint8x16x2_t d = vld2q_u8(Dest);
+      uint8x16_t s = vld1q_u8(pSrc + n);
+      d.val[0] = bXor ? veorq_u8(d.val[0], s) : s;
+      vst2q_u8(Dest, d);
+    }
+  }
+  else if (nGap == 4)
+  {
+    for (; n + 16 < nLen; n += 16, Dest += 64)
+    {
+      uint8x16x4_t d = vld4q_u8(Dest);
+      uint8x16_t s = vld1q_u8(pSrc + n);
+      d.val[0] = bXor ? veorq_u8(d.val[0], s) : s;
+      vst4q_u8(Dest, d);
+    }
+  }
+#endif
+
+  if (bXor)
+  {
+    for (; n < nLen; n++, Dest += nGap) *Dest ^= pSrc[n];
+  }
+  else
+  {
+    for (; n < nLen; n++, Dest += nGap) *Dest  = pSrc[n];
+  }
+}
+
+// BurnExtLoadRom(), adding the time it takes to the startup totals
+static INT32 ExtLoadRom(UINT8 *Dest, INT32 *pnWrote, INT32 i)
+{
+  UINT64 nTime = BurnGetTime();
+  INT32 nRet = BurnExtLoadRom(Dest, pnWrote, i);
+  BurnPhaseAdd("rom unpack", BurnGetTime() - nTime);
+
+  return nRet;
+}
 
 // Load a rom and separate out the bytes by nGap
 // Dest is the memory block to insert the rom into
@@ -26,7 +119,6 @@ static INT32 LoadRom(UINT8 *Dest, INT32 i, INT32 nGap, INT32 bXor)
   if (nGap>1 || bXor)
   {
     UINT8 *Load=NULL;
-    UINT8 *pd=NULL,*pl=NULL,*LoadEnd=NULL;
     INT32 nLoadLen=0;
 
     // Allocate space for the file
@@ -35,26 +127,18 @@ static INT32 LoadRom(UINT8 *Dest, INT32 i, INT32 nGap, INT32 bXor)
     memset(Load,0,nLen);
 
     // Load in the file
-    nRet=BurnExtLoadRom(Load,&nLoadLen,i);
+    nRet=ExtLoadRom(Load,&nLoadLen,i);
 	if (bDoIpsPatch) IpsApplyPatches(Load, RomName);
     if (nRet!=0) { if (Load) { free(Load); Load = NULL; } return 1; }
 
     if (nLoadLen<0) nLoadLen=0;
     if (nLoadLen>nLen) nLoadLen=nLen;
 
-    // Loaded rom okay. Now insert into Dest
-    LoadEnd=Load+nLoadLen;
-    pd=Dest; pl=Load;
-    // Quickly copy in the bytes with a gap of 'nGap' between each byte
+    // Loaded rom okay. Now insert into Dest, with a gap of 'nGap' between each byte
+    UINT64 nTime = BurnGetTime();
+    Spread(Dest, Load, nLoadLen, nGap, bXor);
+    BurnPhaseAdd("rom interleave", BurnGetTime() - nTime);
 
-    if (bXor)
-    {
-      do { *pd ^= *pl++; pd+=nGap; } while (pl<LoadEnd);
-    }
-    else
-    {
-      do { *pd  = *pl++; pd+=nGap; } while (pl<LoadEnd);
-    }
     if (Load) {
 		free(Load);
 		Load = NULL;
@@ -63,7 +147,7 @@ static INT32 LoadRom(UINT8 *Dest, INT32 i, INT32 nGap, INT32 bXor)
   else
   {
     // If no XOR, and gap of 1, just copy straight in
-    nRet=BurnExtLoadRom(Dest,NULL,i);
+    nRet=ExtLoadRom(Dest,NULL,i);
 	if (bDoIpsPatch) IpsApplyPatches(Dest, RomName);
     if (nRet!=0) return 1;
   }
@@ -81,6 +165,219 @@ INT32 BurnXorRom(UINT8 *Dest, INT32 i, INT32 nGap)
   return LoadRom(Dest,i,nGap,1);
 }
 
+// Interleave nCount roms of nLen bytes each into Dest a byte at a time
+static void Interleave(UINT8 *Dest, UINT8 **pSrc, INT32 nCount, INT32 nLen)
+{
+  INT32 n = 0;
+
+  if (nCount == 2)
+  {
+    UINT8 *a = pSrc[0], *b = pSrc[1];
+#if defined LOAD_SSE2
+    for (; n + 16 <= nLen; n += 16, Dest += 32)
+    {
+      __m128i va = _mm_loadu_si128((__m128i *)(a + n));
+      __m128i vb = _mm_loadu_si128((__m128i *)(b + n));
+      _mm_storeu_si128((__m128i *)(Dest +  0), _mm_unpacklo_epi8(va, vb));
+      _mm_storeu_si128((__m128i *)(Dest + 16), _mm_unpackhi_epi8(va, vb));
+    }
+#elif defined LOAD_NEON
+    for (; n + 16 <= nLen; n += 16, Dest += 32)
+    {
+      uint8x16x2_t v = { { vld1q_u8(a + n), vld1q_u8(b + n) } };
+      vst2q_u8(Dest, v);
+    }
+#endif
+    for (; n < nLen; n++) { *Dest++ = a[n]; *Dest++ = b[n]; }
+    return;
+  }
+
+  if (nCount == 4)
+  {
+    UINT8 *a = pSrc[0], *b = pSrc[1], *c = pSrc[2], *d = pSrc[3];
+#if defined LOAD_SSE2
+    for (; n + 16 <= nLen; n += 16, Dest += 64)
+    {
+      __m128i va = _mm_loadu_si128((__m128i *)(a + n));
+      __m128i vb = _mm_loadu_si128((__m128i *)(b + n));
+      __m128i vc = _mm_loadu_si128((__m128i *)(c + n));
+      __m128i vd = _mm_loadu_si128((__m128i *)(d + n));
+      __m128i ablo = _mm_unpacklo_epi8(va, vb), abhi = _mm_unpackhi_epi8(va, vb);
+      __m128i cdlo = _mm_unpacklo_epi8(vc, vd), cdhi = _mm_unpackhi_epi8(vc, vd);
+      _mm_storeu_si128((__m128i *)(Dest +  0), _mm_unpacklo_epi16(ablo, cdlo));
+      _mm_storeu_si128((__m128i *)(Dest + 16), _mm_unpackhi_epi16(ablo, cdlo));
+      _mm_storeu_si128((__m128i *)(Dest + 32), _mm_unpacklo_epi16(abhi, cdhi));
+      _mm_storeu_si128((__m128i *)(Dest + 48), _mm_unpackhi_epi16(abhi, cdhi));
+    }
+#elif defined LOAD_NEON
+    for (; n + 16 <= nLen; n += 16, Dest += 64)
+    {
+      uint8x16x4_t v = { { vld1q_u8(a + n), vld1q_u8(b + n), vld1q_u8(c + n), vld1q_u8(d + n) } };
+      vst4q_u8(Dest, v);
+    }
+#endif
+    for (; n < nLen; n++) { *Dest++ = a[n]; *Dest++ = b[n]; *Dest++ = c[n]; *Dest++ = d[n]; }
+    return;
+  }
+
+  for (; n < nLen; n++)
+  {
+    for (INT32 j = 0; j < nCount; j++) *Dest++ = pSrc[j][n];
+  }
+}
+
+// Reverse the bytes of every 32-bit word, e.g. to turn big endian program roms
+// around for a little endian host
+INT32 BurnByteswap32(UINT8 *pMem, INT32 nLen)
+{
+  INT32 n = 0;
+
+#if defined LOAD_AVX2
+  const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  for (; n + 32 <= nLen; n += 32)
+  {
+    __m256i v = _mm256_loadu_si256((__m256i *)(pMem + n));
+    _mm256_storeu_si256((__m256i *)(pMem + n), _mm256_shuffle_epi8(v, swap));
+  }
+#endif
+#if defined LOAD_SSE2
+  for (; n + 16 <= nLen; n += 16)
+  {
+    __m128i v = _mm_loadu_si128((__m128i *)(pMem + n));
+    // swap the bytes of each half, then the halves
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    _mm_storeu_si128((__m128i *)(pMem + n), v);
+  }
+#elif defined LOAD_NEON
+  for (; n + 16 <= nLen; n += 16)
+  {
+    vst1q_u8(pMem + n, vrev32q_u8(vld1q_u8(pMem + n)));
+  }
+#endif
+
+  for (; n + 4 <= nLen; n += 4)
+  {
+    UINT8 *p = pMem + n, t;
+    t = p[0]; p[0] = p[3]; p[3] = t;
+    t = p[1]; p[1] = p[2]; p[2] = t;
+  }
+
+  return 0;
+}
+
+INT32 BurnLoadRomGroup(UINT8 *Dest, INT32 i, INT32 nRoms)
+{
+  if (BurnExtLoadRom == NULL) return 1;
+  if (nRoms < 1 || nRoms > 8) return 1;
+
+  // the roms all have to be there and the same size, otherwise they're
+  // loaded one by one
+  struct BurnRomInfo ri;
+  INT32 nLen = 0;
+
+  for (INT32 j = 0; j < nRoms; j++)
+  {
+    ri.nType = 0;
+    ri.nLen = 0;
+    BurnDrvGetRomInfo(&ri, i + j);
+    if (ri.nType == 0 || ri.nLen == 0 || (j && ri.nLen != (UINT32)nLen)) nLen = -1;
+    if (nLen < 0) break;
+    nLen = ri.nLen;
+  }
+
+  if (nLen < 0 || nRoms == 1)
+  {
+    for (INT32 j = 0; j < nRoms; j++)
+    {
+      if (LoadRom(Dest + j, i + j, nRoms, 0)) return 1;
+    }
+    return 0;
+  }
+
+  UINT8 *Load = (UINT8 *)malloc(nLen * nRoms);
+  if (Load == NULL) return 1;
+
+  UINT8 *pSrc[8];
+  INT32 bShort = 0;
+
+  for (INT32 j = 0; j < nRoms; j++)
+  {
+    INT32 nLoadLen = 0;
+    pSrc[j] = Load + j * nLen;
+
+    INT32 nRet = ExtLoadRom(pSrc[j], &nLoadLen, i + j);
+    if (bDoIpsPatch)
+    {
+      char* RomName = "";
+      BurnDrvGetRomName(&RomName, i + j, 0);
+      IpsApplyPatches(pSrc[j], RomName);
+    }
+    if (nRet != 0) { free(Load); return 1; }
+
+    // a short rom only sets the bytes it has, as with BurnLoadRom()
+    if (nLoadLen < nLen)
+    {
+      if (nLoadLen < 0) nLoadLen = 0;
+      Spread(Dest + j, pSrc[j], nLoadLen, nRoms, 0);
+      pSrc[j] = NULL;
+      bShort = 1;
+    }
+  }
+
+  UINT64 nTime = BurnGetTime();
+
+  if (bShort)
+  {
+    for (INT32 j = 0; j < nRoms; j++)
+    {
+      if (pSrc[j] == NULL) continue;
+      Spread(Dest + j, pSrc[j], nLen, nRoms, 0);
+    }
+  }
+  else
+  {
+    Interleave(Dest, pSrc, nRoms, nLen);
+  }
+
+  BurnPhaseAdd("rom interleave", BurnGetTime() - nTime);
+
+  free(Load);
+
+  return 0;
+}
+
+static void LoadRomGroups(INT32 nStart, INT32 nEnd, void *pParam)
+{
+  struct BurnRomGroup *pGroups = (struct BurnRomGroup *)pParam;
+
+  for (INT32 n = nStart; n < nEnd; n++)
+  {
+    pGroups[n].nRet = BurnLoadRomGroup(pGroups[n].Dest, pGroups[n].i, pGroups[n].nRoms);
+  }
+}
+
+INT32 BurnLoadRomGroups(struct BurnRomGroup *pGroups, INT32 nCount)
+{
+  if (bBurnExtLoadRomThreadSafe && !bDoIpsPatch)
+  {
+    BurnParallelFor(nCount, LoadRomGroups, pGroups);
+  }
+  else
+  {
+    LoadRomGroups(0, nCount, pGroups);
+  }
+
+  for (INT32 n = 0; n < nCount; n++)
+  {
+    if (pGroups[n].nRet) return 1;
+  }
+
+  return 0;
+}
+
 // Separate out a bitfield into Bit number 'nField' of each nibble in pDest
 // (end result: each dword in memory carries the 8 pixels of a tile line).
 INT32 BurnLoadBitField(UINT8 *pDest, UINT8 *pSrc, INT32 nField, INT32 nSrcLen)
@@ -169,6 +169,11 @@ INT32 ZipOpen(char* szZip);
 INT32 ZipClose();
 INT32 ZipGetList(struct ZipEntry** pList, INT32* pnListCount);
 INT32 ZipLoadFile(UINT8* Dest, INT32 nLen, INT32* pnWrote, INT32 nEntry);
+INT32 ZipPrefetch(INT32* pnEntry, INT32 nCount);
+INT32 ZipLoadFileFrom(char* szZip, UINT8* Dest, INT32 nLen, INT32* pnWrote, INT32 nEntry);
+INT32 ZipGetIndex(char* szZip, UINT32* pOffset, INT32 nMax);
+INT32 ZipSetIndex(char* szZip, UINT32* pOffset, INT32 nCount);
+void ZipCacheFlush();
 INT32 __cdecl ZipLoadOneFile(char* arcName, const char* fileName, void** Dest, INT32* pnWrote);
 
 // bzip.cpp
@@ -3,6 +3,9 @@
 
 #include <vector>
 #include <string>
+#include <sys/stat.h>
+#include "burn_thread.h"
+#include "zlib.h"
 
 #define FBA_VERSION "v0.2.97.29" // Sept 16, 2013 (SVN)
 
@@ -101,6 +104,15 @@ static bool remap_lr_p2 = false;
 static bool core_aspect_par = false;
 
 extern INT32 EnableHiscores;
+extern INT32 cps3_preview_shift;
+extern INT32 cps3_chardma_disk_cache;
+extern INT32 cps3_rom_cache;
+extern INT32 cps3_rom_share;
+extern INT32 cps3_user_compress;
+
+static bool boot_snapshot_enabled = false;
+static bool startup_report_enabled = false;
+static int boot_snapshot_frames = -1; // frames left before the boot snapshot is taken, -1 for none
 
 #define STAT_NOFIND  0
 #define STAT_OK      1
@@ -123,10 +135,26 @@ static ROMFIND g_find_list[1024];
 static unsigned g_rom_count;
 
 static uint32_t *g_fba_frame;
+static bool g_can_dupe = false;
 static int16_t *g_audio_buf;
 INT32 nAudSegLen = 0;
 INT32 g_audio_samplerate = 48000;
 UINT32 nFrameskip = 1;
+static bool frameskip_auto = false;
+
+// Adaptive frameskip: a frame is only skipped when the recent frame costs say it
+// won't fit in the frame budget, and never two in a row
+static struct
+{
+   uint32_t frames;
+   uint32_t skipped;
+   uint32_t forced;        // frames drawn over budget because the previous one was skipped
+   int32_t  avg_cpu;       // running averages, in microseconds
+   int32_t  avg_draw;
+   int32_t  avg_sound;
+   int32_t  avg_other;
+   bool     last_skipped;
+} frameskip_stats;
 
 // libretro globals
 
@@ -140,13 +168,20 @@ static const struct retro_variable var_empty = { NULL, NULL };
 
 static const struct retro_variable var_fba_aspect = { CORE_OPTION_NAME "_aspect", "Core-provided aspect ratio; DAR|PAR" };
 #ifdef WII_VM
-static const struct retro_variable var_fba_frameskip = { CORE_OPTION_NAME "_frameskip", "Frameskip; 1|2|3|4|5|0" };
+static const struct retro_variable var_fba_frameskip = { CORE_OPTION_NAME "_frameskip", "Frameskip; 1|2|3|4|5|auto|0" };
 #else
-static const struct retro_variable var_fba_frameskip = { CORE_OPTION_NAME "_frameskip", "Frameskip; 0|1|2|3|4|5" };
+static const struct retro_variable var_fba_frameskip = { CORE_OPTION_NAME "_frameskip", "Frameskip; 0|1|2|3|4|5|auto" };
 #endif
 static const struct retro_variable var_fba_cpu_speed_adjust = { CORE_OPTION_NAME "_cpu_speed_adjust", "CPU overclock; 100|110|120|130|140|150|160|170|180|190|200" };
 static const struct retro_variable var_fba_diagnostic_input = { CORE_OPTION_NAME "_diagnostic_input", "Diagnostic Input; None|Hold Start|Start + A + B|Hold Start + A + B|Start + L + R|Hold Start + L + R|Hold Select|Select + A + B|Hold Select + A + B|Select + L + R|Hold Select + L + R" };
 static const struct retro_variable var_fba_hiscores = { CORE_OPTION_NAME "_hiscores", "Hiscores; enabled|disabled" };
+static const struct retro_variable var_fba_preview = { CORE_OPTION_NAME "_preview", "Reduced resolution preview; disabled|1/2|1/4" };
+static const struct retro_variable var_fba_gfx_cache = { CORE_OPTION_NAME "_gfx_cache", "Keep decompressed graphics on disk; disabled|enabled" };
+static const struct retro_variable var_fba_rom_cache = { CORE_OPTION_NAME "_rom_cache", "Keep prepared roms on disk (faster start); disabled|enabled" };
+static const struct retro_variable var_fba_rom_share = { CORE_OPTION_NAME "_rom_share", "Share roms between running instances; disabled|enabled" };
+static const struct retro_variable var_fba_boot_snapshot = { CORE_OPTION_NAME "_boot_snapshot", "Start from a snapshot taken after boot (faster start); disabled|enabled" };
+static const struct retro_variable var_fba_startup_report = { CORE_OPTION_NAME "_startup_report", "Save startup timings to the save directory; disabled|enabled" };
+static const struct retro_variable var_fba_low_memory = { CORE_OPTION_NAME "_low_memory", "Compress graphics and sound roms in memory (low memory, need to restart); disabled|enabled" };
 static const struct retro_variable var_fba_samplerate = { CORE_OPTION_NAME "_samplerate", "Samplerate (need to quit retroarch); 48000|44100|32000|22050|11025" };
 
 // Mapping core options
@@ -184,6 +219,7 @@ static void InputTick();
 static void InputMake();
 static bool init_input();
 static void check_variables();
+static void boot_snapshot_frame();
 
 void wav_exit() { }
 
@@ -444,6 +480,13 @@ static void set_environment()
    vars_systems.push_back(&var_fba_controls_p1);
    vars_systems.push_back(&var_fba_controls_p2);
    vars_systems.push_back(&var_fba_hiscores);
+   vars_systems.push_back(&var_fba_preview);
+   vars_systems.push_back(&var_fba_gfx_cache);
+   vars_systems.push_back(&var_fba_rom_cache);
+   vars_systems.push_back(&var_fba_rom_share);
+   vars_systems.push_back(&var_fba_boot_snapshot);
+   vars_systems.push_back(&var_fba_startup_report);
+   vars_systems.push_back(&var_fba_low_memory);
     vars_systems.push_back(&var_fba_samplerate);
 
    // Add the remap L/R to R1/R2 options
@@ -552,6 +595,52 @@ static void ForceFrameStep(int bDraw)
    BurnDrvFrame();
 }
 
+static void frameskip_log_stats()
+{
+   if (frameskip_stats.frames == 0)
+      return;
+
+   log_cb(RETRO_LOG_INFO, "Frameskip: %u of %u frames skipped, %u drawn over budget, avg cpu %d us, draw %d us, sound %d us, other %d us\n",
+         frameskip_stats.skipped, frameskip_stats.frames, frameskip_stats.forced,
+         frameskip_stats.avg_cpu, frameskip_stats.avg_draw, frameskip_stats.avg_sound, frameskip_stats.avg_other);
+}
+
+static bool frameskip_auto_draw()
+{
+   int32_t budget = 100000000 / nBurnFPS;
+   int32_t projected = frameskip_stats.avg_cpu + frameskip_stats.avg_draw + frameskip_stats.avg_sound + frameskip_stats.avg_other;
+
+   if (projected <= budget)
+      return true;
+
+   if (frameskip_stats.last_skipped)
+   {
+      frameskip_stats.forced++;
+      return true;
+   }
+
+   return false;
+}
+
+static void frameskip_auto_update(bool drawn, int32_t elapsed)
+{
+   int32_t other = elapsed - (int32_t)(nBurnFrameTimeCpu + nBurnFrameTimeDraw + nBurnFrameTimeSound);
+
+   frameskip_stats.avg_cpu += ((int32_t)nBurnFrameTimeCpu - frameskip_stats.avg_cpu) / 8;
+   frameskip_stats.avg_sound += ((int32_t)nBurnFrameTimeSound - frameskip_stats.avg_sound) / 8;
+   frameskip_stats.avg_other += ((other > 0 ? other : 0) - frameskip_stats.avg_other) / 8;
+   if (drawn)
+      frameskip_stats.avg_draw += ((int32_t)nBurnFrameTimeDraw - frameskip_stats.avg_draw) / 8;
+
+   frameskip_stats.frames++;
+   if (!drawn)
+      frameskip_stats.skipped++;
+   frameskip_stats.last_skipped = !drawn;
+
+   if ((frameskip_stats.frames % 3600) == 0)
+      frameskip_log_stats();
+}
+
 // Non-idiomatic (OutString should be to the left to match strcpy())
 // Seems broken to not check nOutSize.
 char* TCHARToANSI(const TCHAR* pszInString, char* pszOutString, int /*nOutSize*/)
@@ -569,38 +658,77 @@ int QuoteRead(char **, char **, char*) { return 1; }
 char *LabelCheck(char *, char *) { return 0; }
 const int nConfigMinVersion = 0x020921;
 
-// addition to support loading of roms without crc check
-static int find_rom_by_name(char *name, const ZipEntry *list, unsigned elems)
+// Hash tables over an archive listing, built once per archive so each rom is
+// matched without scanning the whole list. When several entries share a crc
+// or a name the first one is kept, as the old linear search did.
+struct archive_index
+{
+   std::vector<int> crc;
+   std::vector<int> name;
+   unsigned mask;
+};
+
+static unsigned hash_name(const char *name)
 {
-	unsigned i = 0;
-	for (i = 0; i < elems; i++)
+   unsigned hash = 2166136261u;
+   while (*name)
+      hash = (hash ^ (unsigned char)*name++) * 16777619u;
+   return hash;
+}
+
+static void build_archive_index(archive_index &index, const ZipEntry *list, unsigned elems)
+{
+   unsigned size = 16;
+   while (size < elems * 2)
+      size <<= 1;
+
+   index.mask = size - 1;
+   index.crc.assign(size, -1);
+   index.name.assign(size, -1);
+
+   for (unsigned i = 0; i < elems; i++)
    {
-      if(!strcmp(list[i].szName, name)) 
-         return i; 
+      unsigned slot = list[i].nCrc & index.mask;
+      while (index.crc[slot] >= 0 && list[index.crc[slot]].nCrc != list[i].nCrc)
+         slot = (slot + 1) & index.mask;
+      if (index.crc[slot] < 0)
+         index.crc[slot] = i;
+
+      if (!list[i].szName)
+         continue;
+
+      slot = hash_name(list[i].szName) & index.mask;
+      while (index.name[slot] >= 0 && strcmp(list[index.name[slot]].szName, list[i].szName))
+         slot = (slot + 1) & index.mask;
+      if (index.name[slot] < 0)
+         index.name[slot] = i;
    }
+}
 
-#if 0
-   log_cb(RETRO_LOG_ERROR, "Not found: %s (name = %s)\n", list[i].szName, name);
-#endif
+// addition to support loading of roms without crc check
+static int find_rom_by_name(char *name, const ZipEntry *list, const archive_index &index)
+{
+   unsigned slot = hash_name(name) & index.mask;
+   while (index.name[slot] >= 0)
+   {
+      if (!strcmp(list[index.name[slot]].szName, name))
+         return index.name[slot];
+      slot = (slot + 1) & index.mask;
+   }
 
 	return -1;
 }
 
-static int find_rom_by_crc(uint32_t crc, const ZipEntry *list, unsigned elems)
+static int find_rom_by_crc(uint32_t crc, const ZipEntry *list, const archive_index &index)
 {
-	unsigned i = 0;
-   for (i = 0; i < elems; i++)
+   unsigned slot = crc & index.mask;
+   while (index.crc[slot] >= 0)
    {
-      if (list[i].nCrc == crc)
-	  {
-         return i;
-	  }
+      if (list[index.crc[slot]].nCrc == crc)
+         return index.crc[slot];
+      slot = (slot + 1) & index.mask;
    }
 
-#if 0
-   log_cb(RETRO_LOG_ERROR, "Not found: 0x%X (crc: 0x%X)\n", list[i].nCrc, crc);
-#endif
-   
    return -1;
 }
 
@@ -621,12 +749,17 @@ static int archive_load_rom(uint8_t *dest, int *wrote, int i)
 
    int archive = g_find_list[i].nArchive;
 
-   if (ZipOpen((char*)g_find_list_path[archive].c_str()) != 0)
-      return 1;
-
    BurnRomInfo ri = {0};
    BurnDrvGetRomInfo(&ri, i);
 
+#ifndef INCLUDE_7Z_SUPPORT
+   // opens its own handle, so roms can be loaded on several threads
+   if (ZipLoadFileFrom((char*)g_find_list_path[archive].c_str(), dest, ri.nLen, wrote, g_find_list[i].nPos) != 0)
+      return 1;
+#else
+   if (ZipOpen((char*)g_find_list_path[archive].c_str()) != 0)
+      return 1;
+
    if (ZipLoadFile(dest, ri.nLen, wrote, g_find_list[i].nPos) != 0)
    {
       ZipClose();
@@ -634,9 +767,188 @@ static int archive_load_rom(uint8_t *dest, int *wrote, int i)
    }
 
    ZipClose();
+#endif
    return 0;
 }
 
+// Audit manifest
+//
+// What open_archive() worked out for a game is saved as <game>.aud in the save
+// directory: every archive with its size and date, where each rom was found,
+// and the zip entry offsets. While none of the archives change, the next
+// launch reads this back instead of listing and matching them again.
+
+#define AUDIT_MAGIC     0x54445541 // "AUDT"
+#define AUDIT_VERSION   1
+#define AUDIT_MAX_ENTRIES  4096
+
+struct archive_stamp
+{
+   uint64_t size;
+   uint64_t mtime;
+};
+
+// size and date of the archive at path (no extension), false if there isn't one
+static bool stat_archive(const char *path, archive_stamp *stamp)
+{
+   static const char *ext[] = { ".zip",
+#ifdef INCLUDE_7Z_SUPPORT
+      ".7z",
+#endif
+   };
+   char name[1024 + 8];
+   struct stat st;
+
+   for (unsigned i = 0; i < sizeof(ext) / sizeof(ext[0]); i++)
+   {
+      snprintf(name, sizeof(name), "%s%s", path, ext[i]);
+      if (stat(name, &st) == 0)
+      {
+         stamp->size  = (uint64_t)st.st_size;
+         stamp->mtime = (uint64_t)st.st_mtime;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static void audit_filename(char *name, size_t size)
+{
+   snprintf(name, size, "%s%c%s.aud", g_save_dir, slash, BurnDrvGetTextA(DRV_NAME));
+}
+
+static bool audit_read(FILE *fp, void *data, size_t size)
+{
+   return fread(data, size, 1, fp) == 1;
+}
+
+// Fill in g_find_list and g_find_list_path from the manifest if every archive
+// in candidates is as it was when the manifest was written
+static bool audit_load(const std::vector<std::string> &candidates)
+{
+   char name[1024 + 128];
+   audit_filename(name, sizeof(name));
+
+   FILE *fp = fopen(name, "rb");
+   if (!fp)
+      return false;
+
+   std::vector<std::string> paths;
+   std::vector<uint32_t> offsets;
+   std::vector<ROMFIND> found(g_rom_count);
+   uint32_t header[4];
+   bool ok = false;
+
+   if (!audit_read(fp, header, sizeof(header)) || header[0] != AUDIT_MAGIC || header[1] != AUDIT_VERSION || header[2] != g_rom_count)
+      goto done;
+
+   // the archives present now must be the ones present then, unchanged
+   for (unsigned i = 0; i < candidates.size(); i++)
+   {
+      archive_stamp now, then;
+      if (!stat_archive(candidates[i].c_str(), &now))
+         continue;
+      if (paths.size() >= header[3] || !audit_read(fp, &then, sizeof(then)))
+         goto done;
+      if (now.size != then.size || now.mtime != then.mtime)
+         goto done;
+      paths.push_back(candidates[i]);
+   }
+   if (paths.size() != header[3])
+      goto done;
+
+   for (unsigned i = 0; i < g_rom_count; i++)
+   {
+      uint32_t rom[4];
+      if (!audit_read(fp, rom, sizeof(rom)) || rom[0] != g_find_list[i].ri.nCrc || rom[2] >= paths.size())
+         goto done;
+      found[i].nState   = rom[1];
+      found[i].nArchive = rom[2];
+      found[i].nPos     = rom[3];
+   }
+
+   for (unsigned z = 0; z < paths.size(); z++)
+   {
+      uint32_t count;
+      if (!audit_read(fp, &count, sizeof(count)) || count > AUDIT_MAX_ENTRIES)
+         goto done;
+      if (!count)
+         continue;
+      offsets.resize(count);
+      if (!audit_read(fp, &offsets[0], count * sizeof(uint32_t)))
+         goto done;
+      ZipSetIndex((char*)paths[z].c_str(), &offsets[0], count);
+   }
+
+   for (unsigned i = 0; i < g_rom_count; i++)
+   {
+      g_find_list[i].nState   = found[i].nState;
+      g_find_list[i].nArchive = found[i].nArchive;
+      g_find_list[i].nPos     = found[i].nPos;
+   }
+   g_find_list_path = paths;
+   ok = true;
+
+done:
+   fclose(fp);
+   return ok;
+}
+
+static void audit_save()
+{
+   char name[1024 + 128];
+   audit_filename(name, sizeof(name));
+
+   FILE *fp = fopen(name, "wb");
+   if (!fp)
+      return;
+
+   uint32_t header[4] = { AUDIT_MAGIC, AUDIT_VERSION, g_rom_count, (uint32_t)g_find_list_path.size() };
+   bool ok = fwrite(header, sizeof(header), 1, fp) == 1;
+
+   for (unsigned z = 0; z < g_find_list_path.size() && ok; z++)
+   {
+      archive_stamp stamp;
+      ok = stat_archive(g_find_list_path[z].c_str(), &stamp) && fwrite(&stamp, sizeof(stamp), 1, fp) == 1;
+   }
+
+   for (unsigned i = 0; i < g_rom_count && ok; i++)
+   {
+      uint32_t rom[4] = { g_find_list[i].ri.nCrc, g_find_list[i].nState, (uint32_t)g_find_list[i].nArchive, (uint32_t)g_find_list[i].nPos };
+      ok = fwrite(rom, sizeof(rom), 1, fp) == 1;
+   }
+
+   std::vector<uint32_t> offsets(AUDIT_MAX_ENTRIES);
+   for (unsigned z = 0; z < g_find_list_path.size() && ok; z++)
+   {
+      uint32_t count = ZipGetIndex((char*)g_find_list_path[z].c_str(), &offsets[0], AUDIT_MAX_ENTRIES);
+      if (count > AUDIT_MAX_ENTRIES)
+         count = 0;
+      ok = fwrite(&count, sizeof(count), 1, fp) == 1 && (!count || fwrite(&offsets[0], count * sizeof(uint32_t), 1, fp) == 1);
+   }
+
+   fclose(fp);
+
+   if (!ok)
+      remove(name);
+}
+
+// Changes whenever the archive rom i comes from is replaced, so drivers can
+// tell their caches apart from ones made from other files
+static UINT32 __cdecl archive_rom_stamp(INT32 i)
+{
+   archive_stamp stamp;
+
+   if (i < 0 || (unsigned)i >= g_rom_count || g_find_list[i].nState != STAT_OK || g_find_list[i].ri.nLen == 0)
+      return 0;
+
+   if (!stat_archive(g_find_list_path[g_find_list[i].nArchive].c_str(), &stamp))
+      return 0;
+
+   return (UINT32)(stamp.size ^ (stamp.size >> 32)) * 16777619u ^ (UINT32)(stamp.mtime ^ (stamp.mtime >> 32));
+}
+
 // This code is very confusing. The original code is even more confusing :(
 static bool open_archive()
 {
@@ -652,6 +964,7 @@ static bool open_archive()
 	// Check if we have said archives.
 	// Check if archives are found. These are relative to g_rom_dir.
 	char *rom_name;
+	std::vector<std::string> candidates;
 	for (unsigned index = 0; index < 32; index++)
 	{
 		if (BurnDrvGetZipName(&rom_name, index))
@@ -665,8 +978,18 @@ static bool open_archive()
 #else
 		snprintf(path, sizeof(path), "%s/%s", g_rom_dir, rom_name);
 #endif
+		candidates.push_back(path);
+	}
 
-		if (ZipOpen(path) != 0)
+	bool audited = audit_load(candidates);
+	if (audited)
+		log_cb(RETRO_LOG_INFO, "[FBA] Archives unchanged, using the saved audit.\n");
+
+	for (unsigned c = 0; c < candidates.size() && !audited; c++)
+	{
+		const char *path = candidates[c].c_str();
+
+		if (ZipOpen((char*)path) != 0)
 			log_cb(RETRO_LOG_ERROR, "[FBA] Failed to find archive: %s, let's continue with other archives...\n", path);
 		else
 			g_find_list_path.push_back(path);
@@ -674,7 +997,7 @@ static bool open_archive()
 		ZipClose();
 	}
 
-	for (unsigned z = 0; z < g_find_list_path.size(); z++)
+	for (unsigned z = 0; z < g_find_list_path.size() && !audited; z++)
 	{
 		if (ZipOpen((char*)g_find_list_path[z].c_str()) != 0)
 		{
@@ -685,9 +1008,12 @@ static bool open_archive()
         log_cb(RETRO_LOG_INFO, "[FBA] Parsing archive %s.\n", g_find_list_path[z].c_str());
 
 		ZipEntry *list = NULL;
-		int count;
+		int count = 0;
 		ZipGetList(&list, &count);
 
+		archive_index index;
+		build_archive_index(index, list, count);
+
 		// Try to map the ROMs FBA wants to ROMs we find inside our pretty archives ...
 		for (unsigned i = 0; i < g_rom_count; i++)
 		{
@@ -700,20 +1026,20 @@ static bool open_archive()
 				continue;
 			}
 
-            int index = find_rom_by_crc(g_find_list[i].ri.nCrc, list, count);
+            int pos = find_rom_by_crc(g_find_list[i].ri.nCrc, list, index);
 
             BurnDrvGetRomName(&rom_name, i, 0);
 
             bool bad_crc = false;
 
-            if (index < 0)
+            if (pos < 0)
             {
-               index = find_rom_by_name(rom_name, list, count);
+               pos = find_rom_by_name(rom_name, list, index);
                bad_crc = true;
             }
 
 			// USE UNI-BIOS...
-			if (index < 0)
+			if (pos < 0)
 			{
 				log_cb(RETRO_LOG_WARN, "[FBA] Searching ROM at index %d with CRC 0x%08x and name %s => Not Found\n", i, g_find_list[i].ri.nCrc, rom_name);
                continue;              
@@ -728,12 +1054,12 @@ static bool open_archive()
 
 			// Yay, we found it!
 			g_find_list[i].nArchive = z;
-			g_find_list[i].nPos = index;
+			g_find_list[i].nPos = pos;
 			g_find_list[i].nState = STAT_OK;
 
-			if (list[index].nLen < g_find_list[i].ri.nLen)
+			if (list[pos].nLen < g_find_list[i].ri.nLen)
 				g_find_list[i].nState = STAT_SMALL;
-			else if (list[index].nLen > g_find_list[i].ri.nLen)
+			else if (list[pos].nLen > g_find_list[i].ri.nLen)
 				g_find_list[i].nState = STAT_LARGE;
 		}
 
@@ -754,7 +1080,39 @@ static bool open_archive()
 		}
 	}
 
+	if (!audited)
+		audit_save();
+
+#ifdef INCLUDE_7Z_SUPPORT
+	// Decode the solid blocks of every 7z archive up front, several at once, so
+	// archive_load_rom() only copies out of memory
+	for (unsigned z = 0; z < g_find_list_path.size(); z++)
+	{
+		std::vector<int> entries;
+		for (unsigned i = 0; i < g_rom_count; i++)
+		{
+			if (g_find_list[i].nState == STAT_NOFIND || g_find_list[i].nArchive != (int)z)
+				continue;
+			if (g_find_list[i].ri.nType == 0 || g_find_list[i].ri.nLen == 0 || g_find_list[i].ri.nCrc == 0)
+				continue;
+			entries.push_back(g_find_list[i].nPos);
+		}
+
+		if (entries.empty() || ZipOpen((char*)g_find_list_path[z].c_str()) != 0)
+			continue;
+
+		if (ZipPrefetch(&entries[0], entries.size()) != 0)
+			log_cb(RETRO_LOG_WARN, "[FBA] Failed to decode %s ahead, loading it rom by rom.\n", g_find_list_path[z].c_str());
+
+		ZipClose();
+	}
+#endif
+
 	BurnExtLoadRom = archive_load_rom;
+	BurnExtRomStamp = archive_rom_stamp;
+#ifndef INCLUDE_7Z_SUPPORT
+	bBurnExtLoadRomThreadSafe = true;
+#endif
 	return true;
 }
 
@@ -787,6 +1145,9 @@ void retro_deinit()
 
 void retro_reset()
 {
+   // the boot starts over from whatever the nvram now holds
+   boot_snapshot_frames = -1;
+
    if (pgi_reset)
    {
       pgi_reset->Input.nVal = 1;
@@ -830,7 +1191,13 @@ static void check_variables(void)
 	var.key = var_fba_frameskip.key;
 	if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var))
 	{
-		if (strcmp(var.value, "0") == 0)
+		frameskip_auto = false;
+		if (strcmp(var.value, "auto") == 0)
+		{
+			nFrameskip = 1;
+			frameskip_auto = true;
+		}
+		else if (strcmp(var.value, "0") == 0)
 			nFrameskip = 1;
 		else if (strcmp(var.value, "1") == 0)
 			nFrameskip = 2;
@@ -958,6 +1325,71 @@ static void check_variables(void)
          EnableHiscores = false;
    }
 
+   var.key = var_fba_preview.key;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var))
+   {
+      if (strcmp(var.value, "1/2") == 0)
+         cps3_preview_shift = 1;
+      else if (strcmp(var.value, "1/4") == 0)
+         cps3_preview_shift = 2;
+      else
+         cps3_preview_shift = 0;
+   }
+
+   var.key = var_fba_gfx_cache.key;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var))
+   {
+      if (strcmp(var.value, "enabled") == 0)
+         cps3_chardma_disk_cache = 1;
+      else
+         cps3_chardma_disk_cache = 0;
+   }
+
+   var.key = var_fba_rom_cache.key;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var))
+   {
+      if (strcmp(var.value, "enabled") == 0)
+         cps3_rom_cache = 1;
+      else
+         cps3_rom_cache = 0;
+   }
+
+   var.key = var_fba_rom_share.key;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var))
+   {
+      if (strcmp(var.value, "enabled") == 0)
+         cps3_rom_share = 1;
+      else
+         cps3_rom_share = 0;
+   }
+
+   var.key = var_fba_boot_snapshot.key;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var))
+   {
+      if (strcmp(var.value, "enabled") == 0)
+         boot_snapshot_enabled = true;
+      else
+         boot_snapshot_enabled = false;
+   }
+
+   var.key = var_fba_startup_report.key;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var))
+   {
+      if (strcmp(var.value, "enabled") == 0)
+         startup_report_enabled = true;
+      else
+         startup_report_enabled = false;
+   }
+
+   var.key = var_fba_low_memory.key;
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var))
+   {
+      if (strcmp(var.value, "enabled") == 0)
+         cps3_user_compress = 1;
+      else
+         cps3_user_compress = 0;
+   }
+
    var.key = var_fba_samplerate.key;
    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var))
    {
@@ -976,15 +1408,100 @@ static void check_variables(void)
    }
 }
 
+// Startup timing
+//
+// fba_init() times its phases with BurnPhaseBegin/End, the driver its own
+// inside them and the rom loader adds up its totals. The breakdown is logged
+// once the driver is up and again after the first frame. With the startup
+// report option on, everything is also written to <game>.startup.json in the
+// save directory for tracking launch times.
+
+static bool g_startup_timing; // the first frame hasn't run yet
+
+static void startup_log(int first)
+{
+   BurnPhase phase;
+
+   // the spans in order, then the totals
+   for (int n = first; BurnPhaseGet(n, &phase) == 0; n++)
+   {
+      if (phase.nDepth >= 0)
+         log_cb(RETRO_LOG_INFO, "[FBA] Startup: %*s%-*s %9.1f ms%s\n", phase.nDepth * 2, "", 24 - phase.nDepth * 2,
+               phase.szName, phase.nTime / 1000.0, phase.bOpen ? " (unfinished)" : "");
+   }
+
+   for (int n = first; BurnPhaseGet(n, &phase) == 0; n++)
+   {
+      if (phase.nDepth < 0)
+         log_cb(RETRO_LOG_INFO, "[FBA] Startup: %-24s %9.1f ms (all threads)\n", phase.szName, phase.nTime / 1000.0);
+   }
+}
+
+static void startup_save()
+{
+   char name[1024 + 128];
+   snprintf(name, sizeof(name), "%s%c%s.startup.json", g_save_dir, slash, BurnDrvGetTextA(DRV_NAME));
+
+   FILE *fp = fopen(name, "w");
+   if (!fp)
+      return;
+
+   // spans have their start and nesting depth, totals a depth of -1
+   BurnPhase phase;
+   unsigned long long total = 0;
+
+   fprintf(fp, "{\n  \"game\": \"%s\",\n  \"threads\": %d,\n  \"phases\": [", BurnDrvGetTextA(DRV_NAME), BurnThreadCount());
+   for (int n = 0; BurnPhaseGet(n, &phase) == 0; n++)
+   {
+      fprintf(fp, "%s\n    { \"name\": \"%s\", \"depth\": %d, \"start_us\": %llu, \"time_us\": %llu }", n ? "," : "",
+            phase.szName, phase.nDepth, (unsigned long long)phase.nStart, (unsigned long long)phase.nTime);
+      if (phase.nDepth >= 0 && phase.nStart + phase.nTime > total)
+         total = phase.nStart + phase.nTime;
+   }
+   fprintf(fp, "\n  ],\n  \"total_us\": %llu\n}\n", total);
+
+   fclose(fp);
+}
+
 void retro_run()
 {
    int width, height;
    BurnDrvGetVisibleSize(&width, &height);
+   width >>= cps3_preview_shift;
+   height >>= cps3_preview_shift;
    pBurnDraw = (uint8_t*)g_fba_frame;
 
    InputMake();
 
-   ForceFrameStep(nCurrentFrame % nFrameskip == 0);
+   if (g_startup_timing)
+      BurnPhaseBegin("first frame");
+
+   if (frameskip_auto)
+   {
+      bool draw = frameskip_auto_draw();
+      UINT64 start = BurnGetTime();
+
+      ForceFrameStep(draw);
+      frameskip_auto_update(draw, (int32_t)(BurnGetTime() - start));
+   }
+   else
+      ForceFrameStep(nCurrentFrame % nFrameskip == 0);
+
+   boot_snapshot_frame();
+
+   if (g_startup_timing)
+   {
+      BurnPhaseEnd();
+      g_startup_timing = false;
+
+      BurnPhase phase;
+      int n = 0;
+      while (BurnPhaseGet(n + 1, &phase) == 0)
+         n++;
+      startup_log(n);
+      if (startup_report_enabled)
+         startup_save();
+   }
 
    unsigned drv_flags = BurnDrvGetFlags();
    uint32_t height_tmp = height;
@@ -1003,7 +1520,11 @@ void retro_run()
          nBurnPitch = width * pitch_size;
    }
 
-   video_cb(g_fba_frame, width, height, nBurnPitch);
+   // skipped and unchanged frames leave g_fba_frame as it was
+   if (g_can_dupe && (pBurnDraw == NULL || bBurnFrameUnchanged))
+      video_cb(NULL, width, height, nBurnPitch);
+   else
+      video_cb(g_fba_frame, width, height, nBurnPitch);
    audio_batch_cb(g_audio_buf, nBurnSoundLen);
 
    bool updated = false;
@@ -1016,6 +1537,7 @@ void retro_run()
       bool old_remap_lr_p1 = remap_lr_p1;
       bool old_remap_lr_p2 = remap_lr_p2;
       bool old_core_aspect_par = core_aspect_par;
+      INT32 old_preview_shift = cps3_preview_shift;
 
       check_variables();
 
@@ -1040,8 +1562,8 @@ void retro_run()
          set_input_descriptors();
       }
 
-      // adjust aspect ratio if the needed
-      if (old_core_aspect_par != core_aspect_par)
+      // adjust aspect ratio (or the preview size) if the needed
+      if (old_core_aspect_par != core_aspect_par || old_preview_shift != cps3_preview_shift)
       {
          struct retro_system_av_info av_info;
          retro_get_system_av_info(&av_info);
@@ -1101,6 +1623,10 @@ bool retro_unserialize(const void *data, size_t size)
 {
    if (size != state_size)
       return false;
+
+   // a loaded state isn't a clean boot any more
+   boot_snapshot_frames = -1;
+
    BurnAcb = burn_read_state_cb;
    read_state_ptr = (const uint8_t*)data;
    BurnAreaScan(ACB_FULLSCAN | ACB_WRITE, 0);
@@ -1108,6 +1634,163 @@ bool retro_unserialize(const void *data, size_t size)
    return true;
 }
 
+// Boot snapshot
+//
+// Every launch runs the bios and the game's boot (region patching, eeprom
+// checks, warning screens) before the game is usable. With the option on, the
+// first launch saves a full state once the boot has run BOOT_SNAPSHOT_SECONDS
+// with nothing pressed, and later launches restore it through BurnAreaScan()
+// right after init. The snapshot is keyed on the set, the emulator version,
+// the state layout, the overclock, the dip switches and the nvram the boot
+// starts from, and is taken again whenever any of them changes.
+
+#define BOOT_SNAPSHOT_MAGIC    0x544f4f42 // "BOOT"
+#define BOOT_SNAPSHOT_VERSION  1
+#define BOOT_SNAPSHOT_SECONDS  20
+
+static uint32_t boot_snapshot_key;
+static uLong boot_snapshot_crc;
+
+static void boot_snapshot_filename(char *name, size_t size)
+{
+   snprintf(name, size, "%s%c%s.boot", g_save_dir, slash, BurnDrvGetTextA(DRV_NAME));
+}
+
+static int boot_snapshot_nvram_cb(BurnArea *pba)
+{
+   boot_snapshot_crc = crc32(boot_snapshot_crc, (const Bytef*)pba->Data, pba->nLen);
+   return 0;
+}
+
+static uint32_t boot_snapshot_make_key()
+{
+   const char *name = BurnDrvGetTextA(DRV_NAME);
+   uint32_t values[3] = { (uint32_t)nBurnVer, (uint32_t)retro_serialize_size(), (uint32_t)nBurnCPUSpeedAdjust };
+
+   boot_snapshot_crc = crc32(0L, Z_NULL, 0);
+   boot_snapshot_crc = crc32(boot_snapshot_crc, (const Bytef*)name, strlen(name));
+   boot_snapshot_crc = crc32(boot_snapshot_crc, (const Bytef*)FBA_VERSION, strlen(FBA_VERSION));
+   boot_snapshot_crc = crc32(boot_snapshot_crc, (const Bytef*)values, sizeof(values));
+
+   // dip switches
+   struct GameInp *pgi = GameInp;
+   for (unsigned i = 0; i < nGameInpCount; i++, pgi++)
+   {
+      if (pgi->nInput == GIT_CONSTANT)
+         boot_snapshot_crc = crc32(boot_snapshot_crc, &pgi->Input.Constant.nConst, 1);
+   }
+
+   BurnAcb = boot_snapshot_nvram_cb;
+   BurnAreaScan(ACB_NVRAM | ACB_READ, 0);
+
+   return (uint32_t)boot_snapshot_crc;
+}
+
+static bool boot_snapshot_load()
+{
+   char name[1024 + 128];
+   boot_snapshot_filename(name, sizeof(name));
+
+   FILE *fp = fopen(name, "rb");
+   if (!fp)
+      return false;
+
+   size_t size = retro_serialize_size();
+   uint32_t header[5];
+   bool ok = fread(header, sizeof(header), 1, fp) == 1 && header[0] == BOOT_SNAPSHOT_MAGIC && header[1] == BOOT_SNAPSHOT_VERSION
+      && header[2] == boot_snapshot_key && header[3] == size;
+
+   uint8_t *packed = ok ? (uint8_t*)malloc(header[4]) : NULL;
+   uint8_t *state = ok ? (uint8_t*)malloc(size) : NULL;
+   uLongf state_len = size;
+
+   ok = packed && state && fread(packed, header[4], 1, fp) == 1
+      && uncompress(state, &state_len, packed, header[4]) == Z_OK && state_len == size
+      && retro_unserialize(state, size);
+
+   free(packed);
+   free(state);
+   fclose(fp);
+
+   return ok;
+}
+
+static void boot_snapshot_save()
+{
+   char name[1024 + 128];
+   boot_snapshot_filename(name, sizeof(name));
+
+   size_t size = retro_serialize_size();
+   uLongf packed_len = compressBound(size);
+   uint8_t *state = (uint8_t*)malloc(size);
+   uint8_t *packed = (uint8_t*)malloc(packed_len);
+
+   bool ok = state && packed && retro_serialize(state, size)
+      && compress2(packed, &packed_len, state, size, Z_BEST_SPEED) == Z_OK;
+
+   FILE *fp = ok ? fopen(name, "wb") : NULL;
+   if (fp)
+   {
+      uint32_t header[5] = { BOOT_SNAPSHOT_MAGIC, BOOT_SNAPSHOT_VERSION, boot_snapshot_key, (uint32_t)size, (uint32_t)packed_len };
+      ok = fwrite(header, sizeof(header), 1, fp) == 1 && fwrite(packed, packed_len, 1, fp) == 1;
+      fclose(fp);
+
+      if (!ok)
+         remove(name);
+      else
+         log_cb(RETRO_LOG_INFO, "[FBA] Saved the boot snapshot to %s.\n", name);
+   }
+
+   free(state);
+   free(packed);
+}
+
+// Restores the snapshot for this launch, or arranges for one to be taken
+static void boot_snapshot_init()
+{
+   boot_snapshot_frames = -1;
+
+   if (!boot_snapshot_enabled)
+      return;
+
+   boot_snapshot_key = boot_snapshot_make_key();
+
+   if (boot_snapshot_load())
+      log_cb(RETRO_LOG_INFO, "[FBA] Restored the boot snapshot, skipping the boot.\n");
+   else
+      boot_snapshot_frames = BOOT_SNAPSHOT_SECONDS * nBurnFPS / 100;
+}
+
+// Called after every frame, takes the snapshot once the boot has settled
+static void boot_snapshot_frame()
+{
+   if (boot_snapshot_frames < 0)
+      return;
+
+   // anything pressed would end up in the snapshot
+   bool pressed = one_diag_input_pressed;
+
+   struct GameInp *pgi = GameInp;
+   for (unsigned i = 0; i < nGameInpCount && !pressed; i++, pgi++)
+   {
+      if (pgi->nInput == GIT_SWITCH)
+         pressed = (pgi->nType & BIT_GROUP_ANALOG) ? pgi->Input.nVal == 0xFFFF : pgi->Input.nVal != 0;
+   }
+
+   if (pressed)
+   {
+      log_cb(RETRO_LOG_INFO, "[FBA] Input during boot, no boot snapshot this time.\n");
+      boot_snapshot_frames = -1;
+      return;
+   }
+
+   if (--boot_snapshot_frames == 0)
+   {
+      boot_snapshot_save();
+      boot_snapshot_frames = -1;
+   }
+}
+
 void retro_cheat_reset() {}
 void retro_cheat_set(unsigned, bool, const char*) {}
 
@@ -1116,7 +1799,8 @@ void retro_get_system_av_info(struct retro_system_av_info *info)
    int width, height;
    BurnDrvGetVisibleSize(&width, &height);
    int maximum = width > height ? width : height;
-   struct retro_game_geometry geom = { (unsigned)width, (unsigned)height, (unsigned)maximum, (unsigned)maximum };
+   // the preview only renders every 2nd or 4th pixel, the aspect ratio stays
+   struct retro_game_geometry geom = { (unsigned)(width >> cps3_preview_shift), (unsigned)(height >> cps3_preview_shift), (unsigned)maximum, (unsigned)maximum };
    
    int game_aspect_x, game_aspect_y;
    BurnDrvGetAspect(&game_aspect_x, &game_aspect_y);
@@ -1148,7 +1832,15 @@ static bool fba_init(unsigned driver, const char *game_zip_name)
 {
    nBurnDrvActive = driver;
 
-   if (!open_archive()) {
+   BurnPhaseReset();
+   g_startup_timing = false;
+
+   BurnPhaseBegin("archive scan");
+   bool found = open_archive();
+   BurnPhaseEnd();
+
+   if (!found) {
+      ZipCacheFlush();
       log_cb(RETRO_LOG_ERROR, "[FBA] Cannot find driver.\n");
       return false;
    }
@@ -1167,14 +1859,25 @@ static bool fba_init(unsigned driver, const char *game_zip_name)
 
    InpDIPSWInit();
 
+   BurnPhaseBegin("driver init");
    BurnDrvInit();
+   BurnPhaseEnd();
+
+   // the roms are loaded, close the archives kept open for them
+   ZipCacheFlush();
 
    // Now we know real game fps, let's initialize sound buffer again
    init_audio_buffer(nBurnSoundRate, nBurnFPS);
 
    char input[128];
    snprintf (input, sizeof(input), "%s%c%s.fs", g_save_dir, slash, BurnDrvGetTextA(DRV_NAME));
+   BurnPhaseBegin("state load");
    BurnStateLoad(input, 0, NULL);
+   BurnPhaseEnd();
+
+   BurnPhaseBegin("boot snapshot");
+   boot_snapshot_init();
+   BurnPhaseEnd();
 
    int width, height;
    BurnDrvGetVisibleSize(&width, &height);
@@ -1250,6 +1953,9 @@ static bool fba_init(unsigned driver, const char *game_zip_name)
    }
 #endif
 
+   startup_log(0);
+   g_startup_timing = true;
+
    return true;
 }
 
@@ -1370,6 +2076,9 @@ bool retro_load_game(const struct retro_game_info *info)
       set_environment();
       check_variables();
 
+      if (!environ_cb(RETRO_ENVIRONMENT_GET_CAN_DUPE, &g_can_dupe))
+         g_can_dupe = false;
+
       if (!fba_init(i, basename))
          goto error;
 
@@ -1390,6 +2099,9 @@ error:
 bool retro_load_game_special(unsigned, const struct retro_game_info*, size_t) { return false; }
 
 void retro_unload_game(void) {
+   frameskip_log_stats();
+   memset(&frameskip_stats, 0, sizeof(frameskip_stats));
+
    if (driver_inited)
    {
       BurnDrvExit();
@@ -2209,6 +2921,14 @@ int CacheHandle(struct CacheInfo* Cache, unsigned int CacheRead, const char* msg
       if(fileidx)
          CacheRead += step;
 
+      // not kept for this game
+      if(Cache[fileidx].filesize == 0)
+      {
+         step = 0;
+         fileidx++;
+         continue;
+      }
+
       sprintf(CacheName ,"%s%s_%s", CacheDir, Cache[fileidx].filename, ParentName);
 
       if(mode == WRITE)
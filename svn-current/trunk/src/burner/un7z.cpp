@@ -47,6 +47,7 @@
 ***************************************************************************/
 
 #include "un7z.h"
+#include "burn_thread.h"
 
 #include <ctype.h>
 #include <stdlib.h>
@@ -466,6 +467,27 @@ _7z_error _7z_file_decompress(_7z_file *new_7z, void *buffer, UINT32 length, UIN
 	SRes res;
 	int index = new_7z->curr_file_idx;
 
+	size_t offset = 0;
+	size_t outSizeProcessed = 0;
+
+	/* already decoded by _7z_file_prefetch? */
+	UInt32 folderIndex = new_7z->db.FileIndexToFolderIndexMap[index];
+	if (folderIndex != (UInt32)-1 && new_7z->folderBuffer != NULL && new_7z->folderBuffer[folderIndex] != NULL)
+	{
+		for (UInt32 i = new_7z->db.FolderStartFileIndex[folderIndex]; i < (UInt32)index; i++)
+			offset += (size_t)new_7z->db.db.Files[i].Size;
+		outSizeProcessed = (size_t)new_7z->db.db.Files[index].Size;
+
+		if (offset + outSizeProcessed > new_7z->folderSize[folderIndex])
+			return _7ZERR_FILE_CORRUPT;
+
+		*Processed = outSizeProcessed;
+
+		memcpy(buffer, new_7z->folderBuffer[folderIndex] + offset, (length < outSizeProcessed) ? length : outSizeProcessed);
+
+		return _7ZERR_NONE;
+	}
+
 	/* make sure the file is open.. */
 	if (new_7z->archiveStream.file._7z_osdfile==NULL)
 	{
@@ -476,9 +498,6 @@ _7z_error _7z_file_decompress(_7z_file *new_7z, void *buffer, UINT32 length, UIN
 		}
 	}
 
-	size_t offset = 0;
-	size_t outSizeProcessed = 0;
-
 	res = SzArEx_Extract(&new_7z->db, &new_7z->lookStream.s, index,
 		&new_7z->blockIndex, &new_7z->outBuffer, &new_7z->outBufferSize,
 		&offset, &outSizeProcessed,
@@ -496,6 +515,158 @@ _7z_error _7z_file_decompress(_7z_file *new_7z, void *buffer, UINT32 length, UIN
 
 
 
+/*-------------------------------------------------
+    _7z_file_prefetch - decode the folders that
+    hold the given files, one thread per range of
+    folders, each reading through its own handle
+-------------------------------------------------*/
+
+struct _7z_prefetch_job
+{
+	_7z_file *archive;
+	UInt32 *folders;
+	SRes *results;
+};
+
+static void _7z_prefetch_range(INT32 nStart, INT32 nEnd, void *pParam)
+{
+	_7z_prefetch_job *job = (_7z_prefetch_job *)pParam;
+	_7z_file *new_7z = job->archive;
+
+	CFileInStream archiveStream;
+	CLookToRead lookStream;
+
+	archiveStream.file._7z_currfpos = 0;
+	archiveStream.file._7z_length = new_7z->archiveStream.file._7z_length;
+	archiveStream.file._7z_osdfile = fopen(new_7z->filename, "rb");
+	if (!archiveStream.file._7z_osdfile)
+	{
+		for (INT32 i = nStart; i < nEnd; i++)
+			job->results[i] = SZ_ERROR_READ;
+		return;
+	}
+
+	FileInStream_CreateVTable(&archiveStream);
+	LookToRead_CreateVTable(&lookStream, False);
+	lookStream.realStream = &archiveStream.s;
+
+	for (INT32 i = nStart; i < nEnd; i++)
+	{
+		UInt32 folderIndex = job->folders[i];
+		CSzFolder *folder = new_7z->db.db.Folders + folderIndex;
+		UInt64 unpackSizeSpec = SzFolder_GetUnpackSize(folder);
+		size_t unpackSize = (size_t)unpackSizeSpec;
+		UInt64 startOffset = SzArEx_GetFolderStreamPos(&new_7z->db, folderIndex, 0);
+		Byte *buffer = NULL;
+		SRes res = SZ_OK;
+
+		if (unpackSize != unpackSizeSpec)
+			res = SZ_ERROR_MEM;
+
+		if (res == SZ_OK)
+		{
+			buffer = (Byte *)malloc(unpackSize ? unpackSize : 1);
+			if (buffer == NULL)
+				res = SZ_ERROR_MEM;
+		}
+
+		if (res == SZ_OK)
+		{
+			LookToRead_Init(&lookStream);
+			res = LookInStream_SeekTo(&lookStream.s, startOffset);
+		}
+
+		if (res == SZ_OK)
+			res = SzFolder_Decode(folder, new_7z->db.db.PackSizes + new_7z->db.FolderStartPackStreamIndex[folderIndex],
+				&lookStream.s, startOffset, buffer, unpackSize, &new_7z->allocTempImp);
+
+		if (res == SZ_OK && folder->UnpackCRCDefined && CrcCalc(buffer, unpackSize) != folder->UnpackCRC)
+			res = SZ_ERROR_CRC;
+
+		if (res != SZ_OK)
+		{
+			free(buffer);
+			buffer = NULL;
+		}
+
+		/* every thread has its own folders, so no lock is needed */
+		new_7z->folderBuffer[folderIndex] = buffer;
+		new_7z->folderSize[folderIndex] = unpackSize;
+		job->results[i] = res;
+	}
+
+	fclose(archiveStream.file._7z_osdfile);
+}
+
+_7z_error _7z_file_prefetch(_7z_file *new_7z, const UINT32 *indices, int count)
+{
+	UInt32 numFolders = new_7z->db.db.NumFolders;
+	if (numFolders == 0 || count <= 0)
+		return _7ZERR_NONE;
+
+	if (new_7z->folderBuffer == NULL)
+	{
+		new_7z->folderBuffer = (Byte **)calloc(numFolders, sizeof(Byte *));
+		new_7z->folderSize = (size_t *)calloc(numFolders, sizeof(size_t));
+		if (new_7z->folderBuffer == NULL || new_7z->folderSize == NULL)
+		{
+			free(new_7z->folderBuffer);
+			free(new_7z->folderSize);
+			new_7z->folderBuffer = NULL;
+			new_7z->folderSize = NULL;
+			return _7ZERR_OUT_OF_MEMORY;
+		}
+	}
+
+	/* the folders still to decode, each listed once */
+	UInt32 *folders = (UInt32 *)malloc(numFolders * sizeof(UInt32));
+	SRes *results = (SRes *)malloc(numFolders * sizeof(SRes));
+	Byte *wanted = (Byte *)calloc(numFolders, 1);
+	int numWanted = 0;
+
+	if (folders == NULL || results == NULL || wanted == NULL)
+	{
+		free(folders);
+		free(results);
+		free(wanted);
+		return _7ZERR_OUT_OF_MEMORY;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		if (indices[i] >= new_7z->db.db.NumFiles)
+			continue;
+
+		UInt32 folderIndex = new_7z->db.FileIndexToFolderIndexMap[indices[i]];
+		if (folderIndex == (UInt32)-1 || wanted[folderIndex] || new_7z->folderBuffer[folderIndex] != NULL)
+			continue;
+
+		wanted[folderIndex] = 1;
+		folders[numWanted++] = folderIndex;
+	}
+
+	_7z_error _7zerr = _7ZERR_NONE;
+
+	if (numWanted)
+	{
+		_7z_prefetch_job job = { new_7z, folders, results };
+		BurnParallelFor(numWanted, _7z_prefetch_range, &job);
+
+		/* a folder that failed is left to _7z_file_decompress, which reports it */
+		for (int i = 0; i < numWanted; i++)
+			if (results[i] != SZ_OK)
+				_7zerr = _7ZERR_DECOMPRESS_ERROR;
+	}
+
+	free(folders);
+	free(results);
+	free(wanted);
+
+	return _7zerr;
+}
+
+
+
 /***************************************************************************
     CACHE MANAGEMENT
 ***************************************************************************/
@@ -516,6 +687,13 @@ static void free__7z_file(_7z_file *_7z)
 
 
 		if (_7z->outBuffer) IAlloc_Free(&_7z->allocImp, _7z->outBuffer);
+		if (_7z->folderBuffer)
+		{
+			for (UInt32 i = 0; i < _7z->db.db.NumFolders; i++)
+				free(_7z->folderBuffer[i]);
+			free(_7z->folderBuffer);
+			free(_7z->folderSize);
+		}
 		if (_7z->inited) SzArEx_Free(&_7z->db, &_7z->allocImp);
 	
 
@@ -150,6 +150,10 @@ struct __7z_file
 	UInt32 blockIndex;// = 0xFFFFFFFF; /* it can have any value before first call (if outBuffer = 0) */
 	Byte *outBuffer;// = 0; /* it must be 0 before first call for each new archive. */
 	size_t outBufferSize;// = 0;  /* it can have any value before first call (if outBuffer = 0) */
+
+	// folders (solid blocks) decoded by _7z_file_prefetch(), indexed by folder
+	Byte **folderBuffer;
+	size_t *folderSize;
 };
 
 
@@ -179,5 +183,9 @@ int _7z_search_crc_match(_7z_file *new_7z, UINT32 crc, const char *search_filena
 /* decompress the most recently found file in the _7Z */
 _7z_error _7z_file_decompress(_7z_file *new_7z, void *buffer, UINT32 length, UINT32 *Processed);
 
+/* decode the folders holding the given files, several at once, and keep them
+   for _7z_file_decompress() until the file is freed */
+_7z_error _7z_file_prefetch(_7z_file *new_7z, const UINT32 *indices, int count);
+
 
 #endif	/* __UN_7Z_H__ */
@@ -1,6 +1,7 @@
 // Zip module
 #include "burner.h"
 #include "unzip.h"
+#include "burn_thread.h"
 
 #ifdef INCLUDE_7Z_SUPPORT
 #include "un7z.h"
@@ -19,6 +20,238 @@ static INT32 nCurrFile = 0; // The current file we are pointing to
 static _7z_file* _7ZipFile = NULL;
 #endif
 
+// Archive cache
+//
+// ZipGetList() remembers where each entry of a .zip starts, so ZipLoadFile()
+// and ZipLoadFileFrom() can seek straight to an entry instead of stepping
+// through the ones before it. ZipLoadFileFrom() keeps the handles it opens in
+// a small pool until ZipCacheFlush(); each handle is only used by one thread
+// at a time, and the index is shared between them.
+
+#define ZIP_INDEX_COUNT		8
+#define ZIP_POOL_COUNT		16
+
+struct ZipIndex {
+	char szName[MAX_PATH];
+	INT32 nCount;
+	uLong* pOffset;
+};
+
+struct ZipHandle {
+	char szName[MAX_PATH];
+	unzFile File;
+	bool bBusy;
+};
+
+static ZipIndex ZipIndexList[ZIP_INDEX_COUNT];
+static INT32 nZipIndexNext = 0;
+static ZipHandle ZipPool[ZIP_POOL_COUNT];
+static BurnLock* pZipLock = NULL;		// made by ZipOpen(), the cache is skipped without it
+
+static char szCurrZip[MAX_PATH] = "";	// file opened by ZipOpen()
+
+static void ZipIndexStore(const char* szFileName, INT32 nCount, uLong* pOffset)
+{
+	BurnLockEnter(pZipLock);
+
+	ZipIndex* pIndex = NULL;
+	for (INT32 i = 0; i < ZIP_INDEX_COUNT; i++) {
+		if (ZipIndexList[i].pOffset && !strcmp(ZipIndexList[i].szName, szFileName)) {
+			pIndex = &ZipIndexList[i];
+			break;
+		}
+	}
+
+	if (pIndex == NULL) {
+		pIndex = &ZipIndexList[nZipIndexNext];
+		nZipIndexNext = (nZipIndexNext + 1) % ZIP_INDEX_COUNT;
+	}
+
+	if (pIndex->pOffset) free(pIndex->pOffset);
+	strncpy(pIndex->szName, szFileName, MAX_PATH - 1);
+	pIndex->szName[MAX_PATH - 1] = 0;
+	pIndex->nCount = nCount;
+	pIndex->pOffset = pOffset;
+
+	BurnLockLeave(pZipLock);
+}
+
+// Offset of nEntry in the central directory, 0 if it isn't indexed
+static uLong ZipIndexFind(const char* szFileName, INT32 nEntry)
+{
+	uLong nOffset = 0;
+
+	if (pZipLock == NULL || nEntry < 0) return 0;
+
+	BurnLockEnter(pZipLock);
+
+	for (INT32 i = 0; i < ZIP_INDEX_COUNT; i++) {
+		if (ZipIndexList[i].pOffset && !strcmp(ZipIndexList[i].szName, szFileName)) {
+			if (nEntry < ZipIndexList[i].nCount) nOffset = ZipIndexList[i].pOffset[nEntry];
+			break;
+		}
+	}
+
+	BurnLockLeave(pZipLock);
+
+	return nOffset;
+}
+
+// Go to nEntry, by seeking if the archive is indexed
+static INT32 ZipSeekEntry(unzFile File, const char* szFileName, INT32 nEntry)
+{
+	uLong nOffset = ZipIndexFind(szFileName, nEntry);
+	if (nOffset && unzSetOffset(File, nOffset) == UNZ_OK) return UNZ_OK;
+
+	INT32 nRet = unzGoToFirstFile(File);
+	for (INT32 i = 0; i < nEntry && nRet == UNZ_OK; i++) {
+		nRet = unzGoToNextFile(File);
+	}
+
+	return nRet;
+}
+
+// Reserve a pool slot for szFileName, -1 if they are all in use. The slot's
+// handle is NULL when it still has to be opened.
+static INT32 ZipPoolTake(const char* szFileName, unzFile* pStale)
+{
+	INT32 nSlot = -1;
+	*pStale = NULL;
+
+	if (pZipLock == NULL) return -1;
+
+	BurnLockEnter(pZipLock);
+
+	for (INT32 i = 0; i < ZIP_POOL_COUNT; i++) {
+		if (!ZipPool[i].bBusy && ZipPool[i].File && !strcmp(ZipPool[i].szName, szFileName)) {
+			nSlot = i;
+			break;
+		}
+	}
+
+	if (nSlot < 0) {
+		for (INT32 i = 0; i < ZIP_POOL_COUNT; i++) {
+			if (!ZipPool[i].bBusy && ZipPool[i].File == NULL) {
+				nSlot = i;
+				break;
+			}
+		}
+	}
+
+	if (nSlot < 0) {
+		// reuse an idle handle to another archive, it's closed by the caller
+		for (INT32 i = 0; i < ZIP_POOL_COUNT; i++) {
+			if (!ZipPool[i].bBusy) {
+				nSlot = i;
+				*pStale = ZipPool[i].File;
+				ZipPool[i].File = NULL;
+				break;
+			}
+		}
+	}
+
+	if (nSlot >= 0) {
+		ZipPool[nSlot].bBusy = true;
+		if (ZipPool[nSlot].File == NULL) {
+			strncpy(ZipPool[nSlot].szName, szFileName, MAX_PATH - 1);
+			ZipPool[nSlot].szName[MAX_PATH - 1] = 0;
+		}
+	}
+
+	BurnLockLeave(pZipLock);
+
+	return nSlot;
+}
+
+static void ZipPoolGive(INT32 nSlot, unzFile File)
+{
+	BurnLockEnter(pZipLock);
+
+	ZipPool[nSlot].File = File;
+	ZipPool[nSlot].bBusy = false;
+
+	BurnLockLeave(pZipLock);
+}
+
+// Copy out up to nMax entry offsets ZipGetList() found in szZip, returns how
+// many it has (0 if the archive isn't indexed)
+INT32 ZipGetIndex(char* szZip, UINT32* pOffset, INT32 nMax)
+{
+	INT32 nCount = 0;
+
+	if (szZip == NULL || pZipLock == NULL) return 0;
+
+	char szFileName[MAX_PATH];
+	sprintf(szFileName, "%s.zip", szZip);
+
+	BurnLockEnter(pZipLock);
+
+	for (INT32 i = 0; i < ZIP_INDEX_COUNT; i++) {
+		if (ZipIndexList[i].pOffset && !strcmp(ZipIndexList[i].szName, szFileName)) {
+			nCount = ZipIndexList[i].nCount;
+			for (INT32 j = 0; j < nCount && j < nMax; j++) {
+				pOffset[j] = (UINT32)ZipIndexList[i].pOffset[j];
+			}
+			break;
+		}
+	}
+
+	BurnLockLeave(pZipLock);
+
+	return nCount;
+}
+
+// Hand back offsets saved from ZipGetIndex(), so szZip needn't be listed again
+INT32 ZipSetIndex(char* szZip, UINT32* pOffset, INT32 nCount)
+{
+	if (szZip == NULL || nCount <= 0) return 1;
+
+	uLong* pIndex = (uLong *)malloc(nCount * sizeof(uLong));
+	if (pIndex == NULL) return 1;
+
+	for (INT32 i = 0; i < nCount; i++) {
+		pIndex[i] = pOffset[i];
+	}
+
+	char szFileName[MAX_PATH];
+	sprintf(szFileName, "%s.zip", szZip);
+
+	if (pZipLock == NULL) pZipLock = BurnLockCreate();
+	if (pZipLock == NULL) {
+		free(pIndex);
+		return 1;
+	}
+
+	ZipIndexStore(szFileName, nCount, pIndex);
+
+	return 0;
+}
+
+// Close the pooled handles and drop the index. Must not be called while
+// ZipLoadFileFrom() is running on another thread.
+void ZipCacheFlush()
+{
+	for (INT32 i = 0; i < ZIP_POOL_COUNT; i++) {
+		if (ZipPool[i].File) unzClose(ZipPool[i].File);
+	}
+	memset(ZipPool, 0, sizeof(ZipPool));
+
+	for (INT32 i = 0; i < ZIP_INDEX_COUNT; i++) {
+		if (ZipIndexList[i].pOffset) free(ZipIndexList[i].pOffset);
+	}
+	memset(ZipIndexList, 0, sizeof(ZipIndexList));
+	nZipIndexNext = 0;
+
+	if (pZipLock) {
+		BurnLockDestroy(pZipLock);
+		pZipLock = NULL;
+	}
+
+#ifdef INCLUDE_7Z_SUPPORT
+	_7z_file_cache_clear();				// closed 7z files keep their decoded blocks
+#endif
+}
+
 INT32 ZipOpen(char* szZip)
 {
 	nFileType = ZIPFN_FILETYPE_NONE;
@@ -33,6 +266,9 @@ INT32 ZipOpen(char* szZip)
 		nFileType = ZIPFN_FILETYPE_ZIP;
 		unzGoToFirstFile(Zip);
 		nCurrFile = 0;
+
+		strcpy(szCurrZip, szFileName);
+		if (pZipLock == NULL) pZipLock = BurnLockCreate();
 		
 		return 0;
 	}
@@ -99,6 +335,10 @@ INT32 ZipGetList(struct ZipEntry** pList, INT32* pnListCount)
 		INT32 nRet = unzGoToFirstFile(Zip);
 		if (nRet != UNZ_OK) { unzClose(Zip); return 1; }
 
+		// Where each entry starts, for ZipSeekEntry()
+		uLong* pOffset = NULL;
+		if (pZipLock) pOffset = (uLong *)calloc(nListLen ? nListLen : 1, sizeof(uLong));
+
 		// Step through all of the files, until we get to the end
 		INT32 nNextRet = 0;
 
@@ -106,6 +346,8 @@ INT32 ZipGetList(struct ZipEntry** pList, INT32* pnListCount)
 			nCurrFile < nListLen && nNextRet == UNZ_OK;
 			nCurrFile++, nNextRet = unzGoToNextFile(Zip))
 		{
+			if (pOffset) pOffset[nCurrFile] = unzGetOffset(Zip);
+
 			unz_file_info FileInfo;
 			memset(&FileInfo, 0, sizeof(FileInfo));
 
@@ -124,6 +366,8 @@ INT32 ZipGetList(struct ZipEntry** pList, INT32* pnListCount)
 			List[nCurrFile].nCrc = FileInfo.crc;
 		}
 
+		if (pOffset) ZipIndexStore(szCurrZip, nListLen, pOffset);
+
 		// return the file list
 		*pList = List;
 		if (pnListCount != NULL) *pnListCount = nListLen;
@@ -207,6 +451,22 @@ INT32 ZipLoadFile(UINT8* Dest, INT32 nLen, INT32* pnWrote, INT32 nEntry)
 	INT32 nRet = 0;
 	
 	if (nFileType == ZIPFN_FILETYPE_ZIP) {
+		if (nEntry != nCurrFile)
+		{
+			// Seek straight to it if ZipGetList() indexed this archive
+			// (unzGoToNextFile() doesn't work after a seek, so a failed one starts over)
+			uLong nOffset = ZipIndexFind(szCurrZip, nEntry);
+			if (nOffset) {
+				if (unzSetOffset(Zip, nOffset) == UNZ_OK) {
+					nCurrFile = nEntry;
+				} else {
+					nRet = unzGoToFirstFile(Zip);
+					if (nRet != UNZ_OK) return 1;
+					nCurrFile = 0;
+				}
+			}
+		}
+
 		if (nEntry < nCurrFile)
 		{
 			// We'll have to go through the zip file again to get to our entry
@@ -257,6 +517,73 @@ INT32 ZipLoadFile(UINT8* Dest, INT32 nLen, INT32* pnWrote, INT32 nEntry)
 	return 0;
 }
 
+// Let the open archive know which entries ZipLoadFile() will be asked for. A
+// 7z file decodes the solid blocks holding them in parallel and keeps them
+// until ZipCacheFlush(); a zip file has nothing to do.
+INT32 ZipPrefetch(INT32* pnEntry, INT32 nCount)
+{
+	if (pnEntry == NULL || nCount <= 0) return 0;
+
+#ifdef INCLUDE_7Z_SUPPORT
+	if (nFileType == ZIPFN_FILETYPE_7ZIP) {
+		if (_7ZipFile == NULL) return 1;
+
+		if (_7z_file_prefetch(_7ZipFile, (const UINT32*)pnEntry, nCount) != _7ZERR_NONE) return 1;
+	}
+#endif
+
+	return 0;
+}
+
+// Load entry nEntry of szZip (.zip only) without touching the archive opened
+// by ZipOpen(), so it can be called from several threads at once
+INT32 ZipLoadFileFrom(char* szZip, UINT8* Dest, INT32 nLen, INT32* pnWrote, INT32 nEntry)
+{
+	if (szZip == NULL) return 1;
+
+	char szFileName[MAX_PATH];
+	sprintf(szFileName, "%s.zip", szZip);
+
+	unzFile Stale = NULL;
+	INT32 nSlot = ZipPoolTake(szFileName, &Stale);
+	if (Stale) unzClose(Stale);
+
+	unzFile File = (nSlot >= 0) ? ZipPool[nSlot].File : NULL;
+	if (File == NULL) File = unzOpen(szFileName);
+	if (File == NULL) {
+		if (nSlot >= 0) ZipPoolGive(nSlot, NULL);
+		return 1;
+	}
+
+	INT32 nRet = ZipSeekEntry(File, szFileName, nEntry);
+
+	if (nRet == UNZ_OK) nRet = unzOpenCurrentFile(File);
+	if (nRet != UNZ_OK) {
+		if (nSlot >= 0) {
+			ZipPoolGive(nSlot, File);
+		} else {
+			unzClose(File);
+		}
+		return 1;
+	}
+
+	nRet = unzReadCurrentFile(File, Dest, nLen);
+	// Return how many bytes were copied
+	if (nRet >= 0 && pnWrote != NULL) *pnWrote = nRet;
+
+	nRet = unzCloseCurrentFile(File);
+	if (nSlot >= 0) {
+		ZipPoolGive(nSlot, File);
+	} else {
+		unzClose(File);
+	}
+
+	if (nRet == UNZ_CRCERROR) return 2;
+	if (nRet != UNZ_OK) return 1;
+
+	return 0;
+}
+
 // Load one file directly, added by regret
 INT32 __cdecl ZipLoadOneFile(char* arcName, const char* fileName, void** Dest, INT32* pnWrote)
 {
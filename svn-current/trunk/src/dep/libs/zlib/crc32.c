@@ -46,6 +46,56 @@
 #  define TBLS 1
 #endif /* BYFOUR */
 
+/* Hardware CRC-32, chosen at run time.  x86-64 folds 64 bytes at a time with
+   the carry-less multiply (PCLMULQDQ, plus SSE4.1 for the final extract), and
+   ARMv8 has CRC32 instructions for this polynomial.  The SSE4.2 crc32
+   instruction is no use here: it computes the Castagnoli CRC.  Define
+   NO_CRC32_SIMD to build with the tables only. */
+#ifndef NO_CRC32_SIMD
+#  if defined(__x86_64__) && defined(__GNUC__)
+#    define CRC32_PCLMUL
+#    define CRC32_TARGET __attribute__((target("pclmul,sse4.1")))
+#    include <cpuid.h>
+#  elif defined(_M_X64) && defined(_MSC_VER)
+#    define CRC32_PCLMUL
+#    define CRC32_TARGET
+#    include <intrin.h>
+#  elif defined(__aarch64__) && defined(__GNUC__) && \
+        (defined(__ARM_FEATURE_CRC32) || defined(__APPLE__) || defined(__linux__))
+#    define CRC32_ARMV8
+#    ifdef __clang__
+#      define CRC32_TARGET __attribute__((target("crc")))
+#    else
+#      define CRC32_TARGET __attribute__((target("+crc")))
+#    endif
+#    include <arm_acle.h>
+#    if !defined(__ARM_FEATURE_CRC32) && !defined(__APPLE__)
+#      include <sys/auxv.h>
+#      ifndef HWCAP_CRC32
+#        define HWCAP_CRC32 (1 << 7)
+#      endif
+#    endif
+#  endif
+#endif
+
+#ifdef CRC32_PCLMUL
+#  include <emmintrin.h>
+#  include <smmintrin.h>
+#  include <wmmintrin.h>
+   local unsigned long crc32_pclmul OF((unsigned long,
+                        const unsigned char FAR *, uInt));
+#endif
+#ifdef CRC32_ARMV8
+   local unsigned long crc32_armv8 OF((unsigned long,
+                        const unsigned char FAR *, uInt));
+#endif
+#if defined(CRC32_PCLMUL) || defined(CRC32_ARMV8)
+#  define CRC32_SIMD
+   local int crc32_simd_check OF((void));
+   /* -1 until checked; threads may race to set it, but all store the same */
+   local volatile int crc32_simd = -1;
+#endif
+
 /* Local functions for crc concatenation */
 local unsigned long gf2_matrix_times OF((unsigned long *mat,
                                          unsigned long vec));
@@ -213,6 +263,26 @@ unsigned long ZEXPORT crc32(crc, buf, len)
         make_crc_table();
 #endif /* DYNAMIC_CRC_TABLE */
 
+#ifdef CRC32_SIMD
+    if (len >= 64) {
+        if (crc32_simd < 0)
+            crc32_simd = crc32_simd_check();
+        if (crc32_simd) {
+#ifdef CRC32_PCLMUL
+            /* whole 16 byte blocks, the tail goes through the tables */
+            uInt blocks = len & ~15U;
+            crc = crc32_pclmul(crc, buf, blocks);
+            buf += blocks;
+            len -= blocks;
+            if (len == 0)
+                return crc;
+#else
+            return crc32_armv8(crc, buf, len);
+#endif
+        }
+    }
+#endif /* CRC32_SIMD */
+
 #ifdef BYFOUR
     if (sizeof(void *) == sizeof(ptrdiff_t)) {
         z_crc_t endian;
@@ -321,6 +391,141 @@ local unsigned long crc32_big(crc, buf, len)
 
 #endif /* BYFOUR */
 
+#ifdef CRC32_SIMD
+
+/* ========================================================================= */
+local int crc32_simd_check()
+{
+#if defined(CRC32_PCLMUL) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 1)) && (info[2] & (1 << 19));
+#elif defined(CRC32_PCLMUL)
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d))
+        return 0;
+    return (c & (1 << 1)) && (c & (1 << 19));   /* PCLMULQDQ, SSE4.1 */
+#elif defined(__ARM_FEATURE_CRC32) || defined(__APPLE__)
+    return 1;
+#else
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+}
+
+#endif /* CRC32_SIMD */
+
+#ifdef CRC32_PCLMUL
+
+/* ========================================================================= */
+/* Folding with carry-less multiplies, as described in Intel's "Fast CRC
+   Computation for Generic Polynomials Using PCLMULQDQ Instruction".  The
+   constants are x^n mod P for the bit-reflected polynomial, and the last pair
+   is P itself and the Barrett constant.  len is a multiple of 16, at least 64.
+ */
+#define FOLD(x, k, y) \
+    x = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), \
+                                    _mm_clmulepi64_si128(x, k, 0x11)), y)
+
+CRC32_TARGET
+local unsigned long crc32_pclmul(crc, buf, len)
+    unsigned long crc;
+    const unsigned char FAR *buf;
+    uInt len;
+{
+    __m128i k, x0, x1, x2, x3, t, mask;
+
+    x0 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    x1 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    x2 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    x3 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+    x0 = _mm_xor_si128(x0, _mm_cvtsi32_si128((int)~(z_crc_t)crc));
+    buf += 64;
+    len -= 64;
+
+    /* four blocks at once, 64 bytes apart */
+    k = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+    while (len >= 64) {
+        FOLD(x0, k, _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+        FOLD(x1, k, _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+        FOLD(x2, k, _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+        FOLD(x3, k, _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+        buf += 64;
+        len -= 64;
+    }
+
+    /* down to one block, then the rest 16 bytes at a time */
+    k = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+    FOLD(x0, k, x1);
+    FOLD(x0, k, x2);
+    FOLD(x0, k, x3);
+    while (len >= 16) {
+        FOLD(x0, k, _mm_loadu_si128((const __m128i *)buf));
+        buf += 16;
+        len -= 16;
+    }
+
+    /* 128 bits to 64 */
+    mask = _mm_setr_epi32(~0, 0, ~0, 0);
+    t = _mm_clmulepi64_si128(x0, k, 0x10);
+    x0 = _mm_xor_si128(_mm_srli_si128(x0, 8), t);
+
+    k = _mm_set_epi64x(0, 0x0163cd6124LL);
+    t = _mm_srli_si128(x0, 4);
+    x0 = _mm_clmulepi64_si128(_mm_and_si128(x0, mask), k, 0x00);
+    x0 = _mm_xor_si128(x0, t);
+
+    /* Barrett reduction to 32 bits */
+    k = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+    t = _mm_clmulepi64_si128(_mm_and_si128(x0, mask), k, 0x10);
+    t = _mm_clmulepi64_si128(_mm_and_si128(t, mask), k, 0x00);
+    x0 = _mm_xor_si128(x0, t);
+
+    return (unsigned long)(z_crc_t)~_mm_extract_epi32(x0, 1);
+}
+
+#undef FOLD
+
+#endif /* CRC32_PCLMUL */
+
+#ifdef CRC32_ARMV8
+
+/* ========================================================================= */
+CRC32_TARGET
+local unsigned long crc32_armv8(crc, buf, len)
+    unsigned long crc;
+    const unsigned char FAR *buf;
+    uInt len;
+{
+    register uint32_t c;
+
+    c = ~(uint32_t)crc;
+    while (len && ((ptrdiff_t)buf & 7)) {
+        c = __crc32b(c, *buf++);
+        len--;
+    }
+
+    while (len >= 32) {
+        const uint64_t *buf8 = (const uint64_t *)(const void *)buf;
+        c = __crc32d(c, buf8[0]);
+        c = __crc32d(c, buf8[1]);
+        c = __crc32d(c, buf8[2]);
+        c = __crc32d(c, buf8[3]);
+        buf += 32;
+        len -= 32;
+    }
+    while (len >= 8) {
+        c = __crc32d(c, *(const uint64_t *)(const void *)buf);
+        buf += 8;
+        len -= 8;
+    }
+
+    while (len--)
+        c = __crc32b(c, *buf++);
+    return (unsigned long)~c;
+}
+
+#endif /* CRC32_ARMV8 */
+
 #define GF2_DIM 32      /* dimension of GF(2) vectors (length of CRC) */
 
 /* ========================================================================= */
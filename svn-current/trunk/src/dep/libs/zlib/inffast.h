@@ -8,4 +8,18 @@
    subject to change. Applications should only use zlib.h.
  */
 
+/* On 64-bit little endian targets inflate_fast() refills a 64-bit bit buffer
+   eight bytes at a time and copies matches in eight byte chunks, so it needs a
+   little more input and output in hand than the byte at a time version. */
+#if !defined(NO_INFLATE_FAST64) && (defined(__x86_64__) || defined(_M_X64) || \
+    defined(__aarch64__) || defined(_M_ARM64) || \
+    (defined(__powerpc64__) && defined(__LITTLE_ENDIAN__)))
+#  define INFLATE_FAST64
+#  define INFLATE_FAST_MIN_INPUT 8
+#  define INFLATE_FAST_MIN_OUTPUT (258 + 8)
+#else
+#  define INFLATE_FAST_MIN_INPUT 6
+#  define INFLATE_FAST_MIN_OUTPUT 258
+#endif
+
 void ZLIB_INTERNAL inflate_fast OF((z_streamp strm, unsigned start));